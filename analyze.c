@@ -0,0 +1,236 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "analyze.h"
+#include "eval.h"
+#include "protocol.h"
+#include "search.h"
+#include "tt.h"
+
+/* lines held in the ring per worker */
+#define ANALYZE_PER_THREAD 4
+
+/* room for one result line */
+#define RESULT_ROOM 96
+
+enum slot_state {
+    SLOT_FREE, SLOT_QUEUED, SLOT_TAKEN, SLOT_DONE
+};
+
+/* one line of input on its way through */
+struct slot {
+    enum slot_state state;
+    char* line;               /* line_room chars, truncated if longer */
+    int too_long;             /* line did not fit, so it cannot be one */
+    char result[RESULT_ROOM];
+};
+
+/* the ring between the reader, the workers and the writer. line number n
+lives in slot n % capacity, and read - written never exceeds capacity */
+struct ring {
+    pthread_mutex_t lock;
+    pthread_cond_t has_room;  /* reader waits for the writer */
+    pthread_cond_t has_work;  /* workers wait for the reader */
+    pthread_cond_t has_done;  /* writer waits for the workers */
+    struct slot* slots;
+    unsigned int capacity;
+    size_t line_room;
+    unsigned long read;       /* lines handed in by the reader */
+    unsigned long taken;      /* lines picked up by workers */
+    unsigned long written;    /* lines whose result is out */
+    int finished;             /* the reader reached the end of input */
+    FILE* in;
+    unsigned int side;
+    enum type type;
+    analyze_options* opts;
+};
+
+/* reader thread: copies lines of input into free slots, waiting while the
+ring is full */
+static void* reader_main(void* arg) {
+    struct ring* r = (struct ring*)arg;
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, r->in)) != -1) {
+        pthread_mutex_lock(&r->lock);
+        while (r->read - r->written == r->capacity) {
+            pthread_cond_wait(&r->has_room, &r->lock);
+        }
+        struct slot* s = &r->slots[r->read % r->capacity];
+        pthread_mutex_unlock(&r->lock);
+        /* the slot is free, so no one else looks at it until it is queued */
+        s->too_long = ((size_t)len >= r->line_room);
+        size_t n = s->too_long ? r->line_room - 1 : (size_t)len;
+        memcpy(s->line, line, n);
+        s->line[n] = '\0';
+        pthread_mutex_lock(&r->lock);
+        s->state = SLOT_QUEUED;
+        r->read++;
+        pthread_cond_signal(&r->has_work);
+        pthread_mutex_unlock(&r->lock);
+    }
+    free(line);
+    pthread_mutex_lock(&r->lock);
+    r->finished = 1;
+    pthread_cond_broadcast(&r->has_work);
+    pthread_cond_broadcast(&r->has_done);
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+/* helper function that writes the analysis of line, or why it has none,
+into its result, searching with s on g */
+static void analyze_line(search* s, game* g, struct slot* sl,
+unsigned int depth, unsigned int movetime_ms) {
+    const char* winners[4] = {"unknown", "white", "black", "draw"};
+    unsigned int side = g->b->side;
+    if (sl->too_long || game_from_string(g, sl->line) != 0) {
+        snprintf(sl->result, RESULT_ROOM, "error=bad position");
+        return;
+    }
+    if (g->state != 0) {
+        snprintf(sl->result, RESULT_ROOM,
+                 "outcome=%s best=none score=0 depth=0 nodes=0",
+                 winners[g->state]);
+        return;
+    }
+    search_result res = search_run(s, g, depth, movetime_ms);
+    const char* outcome = "unknown";
+    int proven = SCORE_WIN - (int)(side * side); /* within a ply count */
+    if (res.score >= proven || res.score <= -proven) {
+        int mover_wins = (res.score > 0);
+        int white = (g->next == WHITE_NEXT) == mover_wins;
+        outcome = white ? "white" : "black";
+    }
+    char best[16]; /* the game is going, so there is a move, 0 included */
+    move_format(res.best, side, best);
+    snprintf(sl->result, RESULT_ROOM,
+             "outcome=%s best=%s score=%d depth=%u nodes=%lu", outcome,
+             best, res.score, res.depth, res.nodes);
+}
+
+/* worker thread: takes queued lines in order and analyses them with its
+own game and table. every position starts from a cleared table and fresh
+move ordering, so its result does not depend on which worker got it or
+what that worker searched before */
+static void* worker_main(void* arg) {
+    struct ring* r = (struct ring*)arg;
+    analyze_options* o = r->opts;
+    game* g = new_game(r->side, r->type);
+    eval_attach(g);
+    tt* t = tt_new(o->hash_mb);
+    pthread_mutex_lock(&r->lock);
+    while (1) {
+        while (r->taken == r->read && !r->finished) {
+            pthread_cond_wait(&r->has_work, &r->lock);
+        }
+        if (r->taken == r->read) {
+            break;
+        }
+        unsigned long n = r->taken++;
+        struct slot* sl = &r->slots[n % r->capacity];
+        sl->state = SLOT_TAKEN;
+        pthread_mutex_unlock(&r->lock);
+        search* s = search_new(r->side);
+        search_set_table(s, t, 0);
+        tt_clear(t);
+        analyze_line(s, g, sl, o->depth, o->movetime_ms);
+        search_free(s);
+        pthread_mutex_lock(&r->lock);
+        sl->state = SLOT_DONE;
+        if (n == r->written) {
+            pthread_cond_signal(&r->has_done);
+        }
+    }
+    pthread_mutex_unlock(&r->lock);
+    tt_free(t);
+    eval_detach(g);
+    game_free(g);
+    return NULL;
+}
+
+unsigned long analyze_run(FILE* in, FILE* out, unsigned int side,
+enum type type, analyze_options* opts) {
+    if (opts->threads == 0) {
+        fprintf(stderr, "analyze_run: need at least one thread.\n");
+        exit(1);
+    }
+    struct ring r;
+    r.capacity = ANALYZE_PER_THREAD * opts->threads;
+    r.line_room = side * side + 64; /* a position and a little after it */
+    r.slots = (struct slot*)malloc(r.capacity * sizeof(struct slot));
+    char* lines = (char*)malloc(r.capacity * r.line_room);
+    pthread_t* ids = (pthread_t*)malloc(opts->threads * sizeof(pthread_t));
+    if (r.slots == NULL || lines == NULL || ids == NULL) {
+        fprintf(stderr, "analyze_run: malloc failed.\n");
+        exit(1);
+    }
+    for (unsigned int i = 0; i < r.capacity; i++) {
+        r.slots[i].state = SLOT_FREE;
+        r.slots[i].line = lines + i * r.line_room;
+    }
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_cond_init(&r.has_room, NULL);
+    pthread_cond_init(&r.has_work, NULL);
+    pthread_cond_init(&r.has_done, NULL);
+    r.read = 0, r.taken = 0, r.written = 0;
+    r.finished = 0;
+    r.in = in;
+    r.side = side;
+    r.type = type;
+    r.opts = opts;
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, reader_main, &r) != 0) {
+        fprintf(stderr, "analyze_run: could not start a thread.\n");
+        exit(1);
+    }
+    for (unsigned int i = 0; i < opts->threads; i++) {
+        if (pthread_create(&ids[i], NULL, worker_main, &r) != 0) {
+            fprintf(stderr, "analyze_run: could not start a thread.\n");
+            exit(1);
+        }
+    }
+    /* the calling thread writes results out in input order, flushing only
+    when it has to wait for the next one */
+    char result[RESULT_ROOM];
+    pthread_mutex_lock(&r.lock);
+    while (1) {
+        struct slot* sl = &r.slots[r.written % r.capacity];
+        if (r.written == r.read && r.finished) {
+            break;
+        }
+        if (r.written == r.read || sl->state != SLOT_DONE) {
+            pthread_mutex_unlock(&r.lock);
+            fflush(out);
+            pthread_mutex_lock(&r.lock);
+            while (!(r.written == r.read && r.finished)
+                   && (r.written == r.read || sl->state != SLOT_DONE)) {
+                pthread_cond_wait(&r.has_done, &r.lock);
+            }
+            continue;
+        }
+        memcpy(result, sl->result, RESULT_ROOM);
+        sl->state = SLOT_FREE;
+        r.written++;
+        pthread_cond_signal(&r.has_room);
+        pthread_mutex_unlock(&r.lock);
+        fprintf(out, "%s\n", result);
+        pthread_mutex_lock(&r.lock);
+    }
+    pthread_mutex_unlock(&r.lock);
+    fflush(out);
+    pthread_join(reader, NULL);
+    for (unsigned int i = 0; i < opts->threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    pthread_mutex_destroy(&r.lock);
+    pthread_cond_destroy(&r.has_room);
+    pthread_cond_destroy(&r.has_work);
+    pthread_cond_destroy(&r.has_done);
+    free(ids);
+    free(lines);
+    free(r.slots);
+    return r.written;
+}
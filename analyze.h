@@ -0,0 +1,35 @@
+#ifndef _ANALYZE_H
+#define _ANALYZE_H
+
+#include <stdio.h>
+#include "logic.h"
+
+/* settings for a bulk analysis */
+struct analyze_options {
+    unsigned int threads;     /* workers searching positions */
+    unsigned int depth;       /* plies searched per position */
+    unsigned int movetime_ms; /* time limit per position, 0 for none */
+    unsigned int hash_mb;     /* table room per worker */
+};
+
+typedef struct analyze_options analyze_options;
+
+/* reads positions of inputted side from in, one per line as
+game_to_string writes them, and searches each on a game of inputted type.
+a reader thread feeds a ring of 4 * threads lines that the workers take
+from, and the calling thread writes the results to out as they finish, in
+input order, so no more than the ring is ever held and a slow writer holds
+the reader back. every line gets one line back:
+  outcome=O best=M score=S depth=D nodes=N
+where O is white or black when the position is over or the search proved
+it, draw when it is a finished draw and unknown otherwise, M is the best
+move as move_format writes it (none once the game is over) and S is from
+the point of view of the player to move. a line that is not a position
+gets "error=bad position" instead. positions are searched independently,
+each from an empty table, so the results are the same whatever the number
+of threads as long as no time limit cuts a search short. returns the
+number of lines */
+unsigned long analyze_run(FILE* in, FILE* out, unsigned int side,
+                          enum type type, analyze_options* opts);
+
+#endif /* _ANALYZE_H */
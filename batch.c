@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_X86 1
+#endif
+
+
+/* one set of kernels. each handles boards from the first up to the largest
+multiple of its vector width and returns how many it did, the scalar
+kernels then finish the rest */
+struct kernels {
+    const char* name;
+    size_t (*outcomes)(const board_batch* bb, const lines* l,
+                       unsigned char* states);
+    size_t (*twist)(board_batch* bb, const uint64_t* masks,
+                    const unsigned int* deltas, unsigned int steps);
+    size_t (*threats)(const board_batch* bb, const lines* l,
+                      unsigned char* white, unsigned char* black);
+};
+
+/* kernels in use, picked by batch_new or batch_use */
+static const struct kernels* active = NULL;
+
+/* helper function that returns the mask of every cell on the board */
+static uint64_t full_mask(unsigned int side) {
+    unsigned int cells = side * side;
+    return (cells == 64) ? ~(uint64_t)0 : ((uint64_t)1 << cells) - 1;
+}
+
+/* game state by whether white has a line (bit 0), black has one (bit 1)
+and the board is full (bit 2), by the same rules as compute_state. looked
+up rather than branched on, outcomes in a batch are unpredictable */
+static const unsigned char state_of[8] = {0, 1, 2, 3, 3, 1, 2, 3};
+
+/* helper function that returns 1 if line mask m is one marble short for the
+colour holding own and untouched by the one holding other */
+static int threat(uint64_t own, uint64_t other, uint64_t m) {
+    uint64_t gap = m & ~own;
+    return gap != 0 && (gap & (gap - 1)) == 0 && (other & m) == 0;
+}
+
+/* portable kernels, one board at a time, starting at board from */
+
+static void outcomes_from(const board_batch* bb, const lines* l, size_t from,
+unsigned char* states) {
+    uint64_t all = full_mask(bb->side);
+    for (size_t i = from; i < bb->count; i++) {
+        uint64_t b = bb->black[i], w = bb->white[i];
+        int bl = 0, wl = 0;
+        for (unsigned int k = 0; k < l->count; k++) {
+            uint64_t m = l->masks[k];
+            bl |= (b & m) == m;
+            wl |= (w & m) == m;
+        }
+        states[i] = state_of[wl | (bl << 1) | (((b | w) == all) << 2)];
+    }
+}
+
+static void twist_from(board_batch* bb, size_t from, const uint64_t* masks,
+const unsigned int* deltas, unsigned int steps) {
+    for (size_t i = from; i < bb->count; i++) {
+        uint64_t b = bb->black[i], w = bb->white[i];
+        for (unsigned int k = 0; k < steps; k++) {
+            uint64_t t = ((b >> deltas[k]) ^ b) & masks[k];
+            b ^= t ^ (t << deltas[k]);
+            t = ((w >> deltas[k]) ^ w) & masks[k];
+            w ^= t ^ (t << deltas[k]);
+        }
+        bb->black[i] = b, bb->white[i] = w;
+    }
+}
+
+static void threats_from(const board_batch* bb, const lines* l, size_t from,
+unsigned char* white, unsigned char* black) {
+    for (size_t i = from; i < bb->count; i++) {
+        uint64_t b = bb->black[i], w = bb->white[i];
+        unsigned int nw = 0, nb = 0;
+        for (unsigned int k = 0; k < l->count; k++) {
+            nw += threat(w, b, l->masks[k]);
+            nb += threat(b, w, l->masks[k]);
+        }
+        white[i] = (unsigned char)nw, black[i] = (unsigned char)nb;
+    }
+}
+
+static size_t outcomes_scalar(const board_batch* bb, const lines* l,
+unsigned char* states) {
+    outcomes_from(bb, l, 0, states);
+    return bb->count;
+}
+
+static size_t twist_scalar(board_batch* bb, const uint64_t* masks,
+const unsigned int* deltas, unsigned int steps) {
+    twist_from(bb, 0, masks, deltas, steps);
+    return bb->count;
+}
+
+static size_t threats_scalar(const board_batch* bb, const lines* l,
+unsigned char* white, unsigned char* black) {
+    threats_from(bb, l, 0, white, black);
+    return bb->count;
+}
+
+static const struct kernels scalar_kernels = {
+    "scalar", outcomes_scalar, twist_scalar, threats_scalar
+};
+
+#ifdef BATCH_X86
+
+/* AVX2 kernels, four boards per vector */
+
+__attribute__((target("avx2")))
+static size_t outcomes_avx2(const board_batch* bb, const lines* l,
+unsigned char* states) {
+    size_t n = bb->count & ~(size_t)3;
+    __m256i all = _mm256_set1_epi64x((long long)full_mask(bb->side));
+    for (size_t i = 0; i < n; i += 4) {
+        __m256i b = _mm256_load_si256((const __m256i*)&bb->black[i]);
+        __m256i w = _mm256_load_si256((const __m256i*)&bb->white[i]);
+        __m256i bl = _mm256_setzero_si256(), wl = _mm256_setzero_si256();
+        for (unsigned int k = 0; k < l->count; k++) {
+            __m256i m = _mm256_set1_epi64x((long long)l->masks[k]);
+            bl = _mm256_or_si256(bl,
+                     _mm256_cmpeq_epi64(_mm256_and_si256(b, m), m));
+            wl = _mm256_or_si256(wl,
+                     _mm256_cmpeq_epi64(_mm256_and_si256(w, m), m));
+        }
+        __m256i full = _mm256_cmpeq_epi64(_mm256_or_si256(b, w), all);
+        int bm = _mm256_movemask_pd(_mm256_castsi256_pd(bl));
+        int wm = _mm256_movemask_pd(_mm256_castsi256_pd(wl));
+        int fm = _mm256_movemask_pd(_mm256_castsi256_pd(full));
+        unsigned int bits = wm | (bm << 4) | (fm << 8); /* lane j's flags */
+        for (unsigned int j = 0; j < 4; j++) {
+            states[i + j] = state_of[((bits >> j) & 1)
+                | ((bits >> (j + 3)) & 2) | ((bits >> (j + 6)) & 4)];
+        }
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+static size_t twist_avx2(board_batch* bb, const uint64_t* masks,
+const unsigned int* deltas, unsigned int steps) {
+    size_t n = bb->count & ~(size_t)3;
+    __m256i mv[BOARD_MAX_SWAPS];
+    __m128i dv[BOARD_MAX_SWAPS];
+    for (unsigned int k = 0; k < steps; k++) {
+        mv[k] = _mm256_set1_epi64x((long long)masks[k]);
+        dv[k] = _mm_cvtsi32_si128((int)deltas[k]);
+    }
+    uint64_t* words[2] = {bb->black, bb->white};
+    for (unsigned int c = 0; c < 2; c++) {
+        for (size_t i = 0; i < n; i += 4) {
+            __m256i x = _mm256_load_si256((const __m256i*)&words[c][i]);
+            for (unsigned int k = 0; k < steps; k++) {
+                __m256i t = _mm256_and_si256(_mm256_xor_si256(
+                                _mm256_srl_epi64(x, dv[k]), x), mv[k]);
+                x = _mm256_xor_si256(x, _mm256_xor_si256(t,
+                        _mm256_sll_epi64(t, dv[k])));
+            }
+            _mm256_store_si256((__m256i*)&words[c][i], x);
+        }
+    }
+    return n;
+}
+
+/* helper function that returns all ones in the lanes where line mask m is
+one marble short for own and untouched by other */
+__attribute__((target("avx2")))
+static __m256i threat_avx2(__m256i own, __m256i other, __m256i m) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i gap = _mm256_andnot_si256(own, m);
+    __m256i one = _mm256_cmpeq_epi64(_mm256_and_si256(gap,
+                      _mm256_sub_epi64(gap, _mm256_set1_epi64x(1))), zero);
+    __m256i some = _mm256_cmpeq_epi64(gap, zero); /* inverted below */
+    __m256i clear = _mm256_cmpeq_epi64(_mm256_and_si256(other, m), zero);
+    return _mm256_and_si256(_mm256_andnot_si256(some, one), clear);
+}
+
+__attribute__((target("avx2")))
+static size_t threats_avx2(const board_batch* bb, const lines* l,
+unsigned char* white, unsigned char* black) {
+    size_t n = bb->count & ~(size_t)3;
+    uint64_t nw[4], nb[4];
+    for (size_t i = 0; i < n; i += 4) {
+        __m256i b = _mm256_load_si256((const __m256i*)&bb->black[i]);
+        __m256i w = _mm256_load_si256((const __m256i*)&bb->white[i]);
+        __m256i cw = _mm256_setzero_si256(), cb = _mm256_setzero_si256();
+        for (unsigned int k = 0; k < l->count; k++) {
+            __m256i m = _mm256_set1_epi64x((long long)l->masks[k]);
+            /* a true lane is -1, so subtracting counts it */
+            cw = _mm256_sub_epi64(cw, threat_avx2(w, b, m));
+            cb = _mm256_sub_epi64(cb, threat_avx2(b, w, m));
+        }
+        _mm256_storeu_si256((__m256i*)nw, cw);
+        _mm256_storeu_si256((__m256i*)nb, cb);
+        for (unsigned int j = 0; j < 4; j++) {
+            white[i + j] = (unsigned char)nw[j];
+            black[i + j] = (unsigned char)nb[j];
+        }
+    }
+    return n;
+}
+
+static const struct kernels avx2_kernels = {
+    "avx2", outcomes_avx2, twist_avx2, threats_avx2
+};
+
+/* SSE4.1 kernels, two boards per vector */
+
+__attribute__((target("sse4.1")))
+static size_t outcomes_sse4(const board_batch* bb, const lines* l,
+unsigned char* states) {
+    size_t n = bb->count & ~(size_t)1;
+    __m128i all = _mm_set1_epi64x((long long)full_mask(bb->side));
+    for (size_t i = 0; i < n; i += 2) {
+        __m128i b = _mm_load_si128((const __m128i*)&bb->black[i]);
+        __m128i w = _mm_load_si128((const __m128i*)&bb->white[i]);
+        __m128i bl = _mm_setzero_si128(), wl = _mm_setzero_si128();
+        for (unsigned int k = 0; k < l->count; k++) {
+            __m128i m = _mm_set1_epi64x((long long)l->masks[k]);
+            bl = _mm_or_si128(bl, _mm_cmpeq_epi64(_mm_and_si128(b, m), m));
+            wl = _mm_or_si128(wl, _mm_cmpeq_epi64(_mm_and_si128(w, m), m));
+        }
+        __m128i full = _mm_cmpeq_epi64(_mm_or_si128(b, w), all);
+        int bm = _mm_movemask_pd(_mm_castsi128_pd(bl));
+        int wm = _mm_movemask_pd(_mm_castsi128_pd(wl));
+        int fm = _mm_movemask_pd(_mm_castsi128_pd(full));
+        unsigned int bits = wm | (bm << 4) | (fm << 8); /* lane j's flags */
+        for (unsigned int j = 0; j < 2; j++) {
+            states[i + j] = state_of[((bits >> j) & 1)
+                | ((bits >> (j + 3)) & 2) | ((bits >> (j + 6)) & 4)];
+        }
+    }
+    return n;
+}
+
+__attribute__((target("sse4.1")))
+static size_t twist_sse4(board_batch* bb, const uint64_t* masks,
+const unsigned int* deltas, unsigned int steps) {
+    size_t n = bb->count & ~(size_t)1;
+    __m128i mv[BOARD_MAX_SWAPS], dv[BOARD_MAX_SWAPS];
+    for (unsigned int k = 0; k < steps; k++) {
+        mv[k] = _mm_set1_epi64x((long long)masks[k]);
+        dv[k] = _mm_cvtsi32_si128((int)deltas[k]);
+    }
+    uint64_t* words[2] = {bb->black, bb->white};
+    for (unsigned int c = 0; c < 2; c++) {
+        for (size_t i = 0; i < n; i += 2) {
+            __m128i x = _mm_load_si128((const __m128i*)&words[c][i]);
+            for (unsigned int k = 0; k < steps; k++) {
+                __m128i t = _mm_and_si128(_mm_xor_si128(
+                                _mm_srl_epi64(x, dv[k]), x), mv[k]);
+                x = _mm_xor_si128(x, _mm_xor_si128(t,
+                        _mm_sll_epi64(t, dv[k])));
+            }
+            _mm_store_si128((__m128i*)&words[c][i], x);
+        }
+    }
+    return n;
+}
+
+/* helper function, threat_avx2 on two boards */
+__attribute__((target("sse4.1")))
+static __m128i threat_sse4(__m128i own, __m128i other, __m128i m) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i gap = _mm_andnot_si128(own, m);
+    __m128i one = _mm_cmpeq_epi64(_mm_and_si128(gap,
+                      _mm_sub_epi64(gap, _mm_set1_epi64x(1))), zero);
+    __m128i some = _mm_cmpeq_epi64(gap, zero); /* inverted below */
+    __m128i clear = _mm_cmpeq_epi64(_mm_and_si128(other, m), zero);
+    return _mm_and_si128(_mm_andnot_si128(some, one), clear);
+}
+
+__attribute__((target("sse4.1")))
+static size_t threats_sse4(const board_batch* bb, const lines* l,
+unsigned char* white, unsigned char* black) {
+    size_t n = bb->count & ~(size_t)1;
+    uint64_t nw[2], nb[2];
+    for (size_t i = 0; i < n; i += 2) {
+        __m128i b = _mm_load_si128((const __m128i*)&bb->black[i]);
+        __m128i w = _mm_load_si128((const __m128i*)&bb->white[i]);
+        __m128i cw = _mm_setzero_si128(), cb = _mm_setzero_si128();
+        for (unsigned int k = 0; k < l->count; k++) {
+            __m128i m = _mm_set1_epi64x((long long)l->masks[k]);
+            cw = _mm_sub_epi64(cw, threat_sse4(w, b, m));
+            cb = _mm_sub_epi64(cb, threat_sse4(b, w, m));
+        }
+        _mm_storeu_si128((__m128i*)nw, cw);
+        _mm_storeu_si128((__m128i*)nb, cb);
+        for (unsigned int j = 0; j < 2; j++) {
+            white[i + j] = (unsigned char)nw[j];
+            black[i + j] = (unsigned char)nb[j];
+        }
+    }
+    return n;
+}
+
+static const struct kernels sse4_kernels = {
+    "sse4", outcomes_sse4, twist_sse4, threats_sse4
+};
+
+#endif /* BATCH_X86 */
+
+/* helper function that returns the kernels named isa if the processor can
+run them, NULL otherwise */
+static const struct kernels* find_kernels(const char* isa) {
+#ifdef BATCH_X86
+    __builtin_cpu_init();
+    if (strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        return &avx2_kernels;
+    } else if (strcmp(isa, "sse4") == 0 && __builtin_cpu_supports("sse4.1")) {
+        return &sse4_kernels;
+    }
+#endif
+    return (strcmp(isa, "scalar") == 0) ? &scalar_kernels : NULL;
+}
+
+/* helper function that picks the widest kernels the processor can run */
+static const struct kernels* pick_kernels(void) {
+    if (active == NULL) {
+        const struct kernels* k = find_kernels("avx2");
+        k = (k != NULL) ? k : find_kernels("sse4");
+        active = (k != NULL) ? k : &scalar_kernels;
+    }
+    return active;
+}
+
+board_batch* batch_new(unsigned int side, size_t capacity) {
+    if (side < 4 || side > 8 || side % 2 != 0) {
+        fprintf(stderr, "batch_new: side must be 4, 6 or 8.\n");
+        exit(1);
+    }
+    board_batch* bb = (board_batch*)malloc(sizeof(board_batch));
+    /* whole cache lines, so vector loads never run off the end */
+    size_t bytes = ((capacity * sizeof(uint64_t)) + 63) & ~(size_t)63;
+    bytes = (bytes == 0) ? 64 : bytes;
+    if (bb == NULL) {
+        fprintf(stderr, "batch_new: malloc failed.\n");
+        exit(1);
+    }
+    bb->black = (uint64_t*)aligned_alloc(64, bytes);
+    bb->white = (uint64_t*)aligned_alloc(64, bytes);
+    if (bb->black == NULL || bb->white == NULL) {
+        fprintf(stderr, "batch_new: malloc failed.\n");
+        exit(1);
+    }
+    memset(bb->black, 0, bytes);
+    memset(bb->white, 0, bytes);
+    bb->side = side;
+    bb->count = 0;
+    bb->capacity = capacity;
+    pick_kernels();
+    return bb;
+}
+
+void batch_free(board_batch* bb) {
+    free(bb->black);
+    free(bb->white);
+    free(bb);
+}
+
+void batch_load(board_batch* bb, size_t i, game* g) {
+    if (i >= bb->capacity || g->b->side != bb->side) {
+        fprintf(stderr, "batch_load: game does not fit the batch.\n");
+        exit(1);
+    }
+    if (g->b->type == MASKS) { /* same layout already */
+        bb->black[i] = g->b->u.masks[0], bb->white[i] = g->b->u.masks[1];
+    } else {
+        uint64_t b = 0, w = 0;
+        for (unsigned int r = 0; r < bb->side; r++) {
+            for (unsigned int c = 0; c < bb->side; c++) {
+                square s = board_get(g->b, make_pos(r, c));
+                uint64_t bit = (uint64_t)1 << ((r * bb->side) + c);
+                b |= (s == BLACK) ? bit : 0;
+                w |= (s == WHITE) ? bit : 0;
+            }
+        }
+        bb->black[i] = b, bb->white[i] = w;
+    }
+    if (i >= bb->count) {
+        bb->count = i + 1;
+    }
+}
+
+square batch_get(const board_batch* bb, size_t i, pos p) {
+    unsigned int cell = (p.r * bb->side) + p.c;
+    if ((bb->black[i] >> cell) & 1) {
+        return BLACK;
+    }
+    return ((bb->white[i] >> cell) & 1) ? WHITE : EMPTY;
+}
+
+void batch_outcomes(const board_batch* bb, unsigned char* states) {
+    const lines* l = lines_get(bb->side);
+    size_t done = active->outcomes(bb, l, states);
+    outcomes_from(bb, l, done, states);
+}
+
+void batch_twist(board_batch* bb, quadrant q, direction d) {
+    uint64_t masks[BOARD_MAX_SWAPS];
+    unsigned int deltas[BOARD_MAX_SWAPS], half = bb->side / 2;
+    unsigned int r_offset = (q == SW || q == SE) ? half : 0;
+    unsigned int c_offset = (q == NE || q == SE) ? half : 0;
+    unsigned int steps = board_swaps(bb->side, make_pos(r_offset, c_offset),
+                                     d == CW, masks, deltas);
+    size_t done = active->twist(bb, masks, deltas, steps);
+    twist_from(bb, done, masks, deltas, steps);
+}
+
+void batch_threats(const board_batch* bb, unsigned char* white,
+unsigned char* black) {
+    const lines* l = lines_get(bb->side);
+    size_t done = active->threats(bb, l, white, black);
+    threats_from(bb, l, done, white, black);
+}
+
+const char* batch_isa(void) {
+    return pick_kernels()->name;
+}
+
+int batch_use(const char* isa) {
+    const struct kernels* k = find_kernels(isa);
+    if (k == NULL) {
+        return 0;
+    }
+    active = k;
+    return 1;
+}
@@ -0,0 +1,54 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <stddef.h>
+#include "logic.h"
+
+/* many boards of one side (at most 8) stored as structure of arrays: the
+BLACK and WHITE bit masks of board i are black[i] and white[i], laid out
+like a MASKS board, so whole vectors of boards load at once */
+struct board_batch {
+    unsigned int side;
+    size_t count;     /* boards in use */
+    size_t capacity;  /* boards there is room for */
+    uint64_t* black;  /* 64 byte aligned */
+    uint64_t* white;
+};
+
+typedef struct board_batch board_batch;
+
+/* creates an empty batch with room for capacity boards of inputted side */
+board_batch* batch_new(unsigned int side, size_t capacity);
+
+/* frees a batch */
+void batch_free(board_batch* bb);
+
+/* copies the board of g, of any type, into slot i, growing count to cover
+it. g must have the batch's side */
+void batch_load(board_batch* bb, size_t i, game* g);
+
+/* returns the square at position p of board i */
+square batch_get(const board_batch* bb, size_t i, pos p);
+
+/* writes the state of every board to states: 0 if play goes on, 1 if
+white has won, 2 if black has, 3 for a draw. the same codes and rules as
+a game in that position, so game_outcome can be read off a lane */
+void batch_outcomes(const board_batch* bb, unsigned char* states);
+
+/* twists quadrant q of every board in direction d */
+void batch_twist(board_batch* bb, quadrant q, direction d);
+
+/* counts, for every board, the lines each colour could complete with one
+more marble: all but one cell its own and none the opponent's */
+void batch_threats(const board_batch* bb, unsigned char* white,
+                   unsigned char* black);
+
+/* returns the instruction set the kernels run on: "avx2", "sse4" or
+"scalar". picked once from what the processor supports */
+const char* batch_isa(void);
+
+/* makes the kernels run on isa ("avx2", "sse4" or "scalar") from now on.
+returns 0 and changes nothing if the processor cannot run it */
+int batch_use(const char* isa);
+
+#endif /* _BATCH_H */
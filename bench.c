@@ -0,0 +1,489 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "batch.h"
+#include "dfpn.h"
+#include "eval.h"
+#include "logic.h"
+#include "rng.h"
+
+/* every result is printed as one line: the benchmark name followed by
+key=value fields, so runs can be diffed and parsed between releases */
+
+/* representations benchmarked, MASKS only where the side allows it */
+#define TYPES 4
+const enum type types[TYPES] = {CELLS, BITS, MASKS, LARGE};
+const char* type_names[TYPES] = {"CELLS", "BITS", "MASKS", "LARGE"};
+
+/* keeps benchmarked results alive so the compiler cannot drop the work */
+volatile unsigned long sink;
+
+/* helper function that returns the current monotonic time in nanoseconds */
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+/* helper function that fills roughly two thirds of a board with marbles so
+rotations move real data around */
+void scatter(board* b) {
+    srand(b->side);
+    for (unsigned int r = 0; r < b->side; r++) {
+        for (unsigned int c = 0; c < b->side; c++) {
+            board_set(b, make_pos(r, c), (square)(rand() % 3));
+        }
+    }
+}
+
+/* helper function that sets up one of the standard perft positions:
+"empty" is the starting position, "middle" is reached by plies pseudo
+random moves from a fixed seed, so every representation gets the same one */
+void standard_position(game* g, const char* name) {
+    move ms[MAX_MOVES(8)];
+    unsigned long seed = 12345;
+    unsigned int plies = (strcmp(name, "middle") == 0) ? g->b->side : 0;
+    for (unsigned int i = 0; i < plies; i++) {
+        unsigned int n = generate_moves(g, ms);
+        if (n == 0) {
+            break;
+        }
+        seed = (seed * 6364136223846793005UL) + 1442695040888963407UL;
+        make_move(g, ms[(seed >> 33) % n]);
+    }
+}
+
+/* helper function that runs perft on one standard position for every
+representation, then checks that all of them counted the same nodes */
+void bench_perft(unsigned int side, const char* position, unsigned int depth) {
+    unsigned long counts[TYPES];
+    unsigned int k, tried = 0;
+    move* buffer = (move*)malloc(depth * MAX_MOVES(side) * sizeof(move));
+    if (buffer == NULL) {
+        fprintf(stderr, "bench_perft: malloc failed.\n");
+        exit(1);
+    }
+    for (k = 0; k < TYPES; k++) {
+        if (types[k] == MASKS && side > 8) {
+            continue;
+        }
+        game* g = new_game(side, types[k]);
+        standard_position(g, position);
+        double start = now_ns();
+        counts[tried] = perft(g, depth, buffer);
+        double seconds = (now_ns() - start) / 1e9;
+        printf("perft side=%u type=%s position=%s depth=%u nodes=%lu "
+               "seconds=%.3f nodes/s=%.0f\n", side, type_names[k], position,
+               depth, counts[tried], seconds, counts[tried] / seconds);
+        game_free(g);
+        tried++;
+    }
+    int match = 1;
+    for (k = 1; k < tried; k++) {
+        match = match && (counts[k] == counts[0]);
+    }
+    printf("perft_check side=%u position=%s depth=%u match=%d\n", side,
+           position, depth, match);
+    free(buffer);
+}
+
+/* helper function that compares generate_moves with generate_unique_moves
+over the position and every position one move after it, summing the moves
+each writes and timing them */
+void bench_branching(unsigned int side, const char* position) {
+    unsigned int cap = MAX_MOVES(side), n, i, k;
+    unsigned long nodes = 0, sums[3] = {0, 0, 0};
+    double ns[3] = {0, 0, 0};
+    move* root = (move*)malloc(2 * cap * sizeof(move));
+    if (root == NULL) {
+        fprintf(stderr, "bench_branching: malloc failed.\n");
+        exit(1);
+    }
+    move* ms = root + cap;
+    game* g = new_game(side, (side <= 8) ? MASKS : BITS);
+    standard_position(g, position);
+    n = generate_moves(g, root);
+    for (i = 0; i <= n; i++) { /* the root itself, then each child */
+        if (i > 0) {
+            make_move(g, root[i - 1]);
+        }
+        for (k = 0; k < 3; k++) {
+            double start = now_ns();
+            sums[k] += (k == 0) ? generate_moves(g, ms)
+                     : generate_unique_moves(g, ms, k == 2);
+            ns[k] += now_ns() - start;
+        }
+        if (i > 0) {
+            unmake_move(g, root[i - 1]);
+        }
+        nodes++;
+    }
+    printf("branching side=%u position=%s nodes=%lu all=%.1f unique=%.1f "
+           "unique_hash=%.1f ns/node all=%.0f unique=%.0f unique_hash=%.0f\n",
+           side, position, nodes, (double)sums[0] / nodes,
+           (double)sums[1] / nodes, (double)sums[2] / nodes, ns[0] / nodes,
+           ns[1] / nodes, ns[2] / nodes);
+    game_free(g);
+    free(root);
+}
+
+/* helper function that times scoring a leaf (make a move, score, unmake)
+with a random network of 64 first layer sums on every instruction set the
+processor has, against the line scores, from the middle position */
+void bench_nnue(unsigned int side) {
+    char path[] = "/tmp/bench_nnue_XXXXXX";
+    const char* isas[2] = {"scalar", "avx2"};
+    int fd = mkstemp(path);
+    if (fd < 0 || nnue_write_random(path, side, 64, 1) != 0) {
+        fprintf(stderr, "bench_nnue: could not write a network.\n");
+        exit(1);
+    }
+    close(fd);
+    nnue* net = nnue_load(path);
+    unlink(path); /* the mapping stays valid */
+    if (net == NULL) {
+        fprintf(stderr, "bench_nnue: could not load the network.\n");
+        exit(1);
+    }
+    move ms[MAX_MOVES(8)];
+    unsigned long reps = 2000, r, i, total = 0;
+    double lines_ns = 0;
+    const char* best = nnue_isa();
+    for (int k = -1; k < 2; k++) { /* the line scores first */
+        if (k >= 0 && !nnue_use(isas[k])) {
+            continue;
+        }
+        eval_use_network((k >= 0) ? net : NULL);
+        game* g = new_game(side, MASKS);
+        standard_position(g, "middle");
+        eval_attach(g);
+        unsigned int n = generate_moves(g, ms);
+        double start = now_ns();
+        for (r = 0; r < reps; r++) {
+            for (i = 0; i < n; i++) {
+                make_move(g, ms[i]);
+                total += eval_score(g);
+                unmake_move(g, ms[i]);
+            }
+        }
+        double leaf = (now_ns() - start) / (reps * n);
+        start = now_ns();
+        for (r = 0; r < reps * n; r++) {
+            total += eval_score(g);
+        }
+        double score = (now_ns() - start) / (reps * n);
+        if (k < 0) {
+            lines_ns = leaf;
+        } else {
+            printf("nnue side=%u isa=%s hidden=64 leaf_ns=%.1f score_ns=%.1f "
+                   "lines_leaf_ns=%.1f\n", side, isas[k], leaf, score,
+                   lines_ns);
+        }
+        game_free(g);
+    }
+    sink = total;
+    nnue_use(best);
+    eval_use_network(NULL);
+    nnue_unload(net);
+}
+
+/* helper function that runs the proof number solver on a standard
+position, solving 4x4 ones outright and giving larger boards a fixed
+budget of nodes, and prints the nodes expanded and proven per second */
+void bench_dfpn(unsigned int side, const char* position) {
+    game* g = new_game(side, MASKS);
+    standard_position(g, position);
+    dfpn_options opts = {16, NULL, 0, 0, (side == 4) ? 0 : 4096};
+    const char* values[4] = {"unknown", "win", "loss", "draw"};
+    dfpn_result res = dfpn_solve(g, &opts);
+    printf("dfpn side=%u position=%s value=%s nodes=%lu proven=%lu "
+           "seconds=%.3f nodes/s=%.0f proven/s=%.0f\n", side, position,
+           values[res.value], res.nodes, res.proven, res.seconds,
+           res.nodes / res.seconds, res.proven / res.seconds);
+    game_free(g);
+}
+
+/* helper function that times board_get and board_set over random cells */
+void bench_access(unsigned int side, unsigned int k) {
+    board* b = board_new(side, types[k]);
+    unsigned long ops = 4000000, i, total = 0;
+    pos ps[256];
+    scatter(b);
+    for (i = 0; i < 256; i++) {
+        ps[i] = make_pos(rand() % side, rand() % side);
+    }
+    double start = now_ns();
+    for (i = 0; i < ops; i++) {
+        total += board_get(b, ps[i & 255]);
+    }
+    double get_ns = (now_ns() - start) / ops;
+    start = now_ns();
+    for (i = 0; i < ops; i++) {
+        board_set(b, ps[i & 255], (square)(i % 3));
+    }
+    double set_ns = (now_ns() - start) / ops;
+    sink = total;
+    printf("board_get side=%u type=%s ops=%lu ns/op=%.2f\n", side,
+           type_names[k], ops, get_ns);
+    printf("board_set side=%u type=%s ops=%lu ns/op=%.2f\n", side,
+           type_names[k], ops, set_ns);
+    board_free(b);
+}
+
+/* helper function that times quadrant rotations on one board, cycling
+through every quadrant and both directions */
+void bench_rotate(unsigned int side, unsigned int k) {
+    board* b = board_new(side, types[k]);
+    unsigned int half = side / 2;
+    pos corners[4] = {
+        make_pos(0, 0), make_pos(0, half), make_pos(half, 0),
+        make_pos(half, half)
+    };
+    unsigned long ops = 4000000 / side, i;
+    scatter(b);
+    double start = now_ns();
+    for (i = 0; i < ops; i++) {
+        board_rotate(b, corners[i & 3], (i >> 2) & 1);
+    }
+    double ns = (now_ns() - start) / ops;
+    printf("board_rotate side=%u type=%s ops=%lu ns/op=%.1f rot/s=%.0f\n",
+           side, type_names[k], ops, ns, 1e9 / ns);
+    board_free(b);
+}
+
+/* helper function that times twist_quadrant, which also keeps the line
+counts and cached outcome up to date, and asking whether the game is over */
+void bench_game(unsigned int side, unsigned int k) {
+    game* g = new_game(side, types[k]);
+    unsigned long ops = 4000000 / side, i, total = 0;
+    standard_position(g, "middle");
+    double start = now_ns();
+    for (i = 0; i < ops; i++) {
+        twist_quadrant(g, (quadrant)(i & 3), (direction)((i >> 2) & 1));
+    }
+    double twist_ns = (now_ns() - start) / ops;
+    start = now_ns();
+    for (i = 0; i < ops; i++) {
+        total += game_over(g);
+    }
+    double over_ns = (now_ns() - start) / ops;
+    sink = total;
+    printf("twist_quadrant side=%u type=%s ops=%lu ns/op=%.1f\n", side,
+           type_names[k], ops, twist_ns);
+    printf("is_game_over side=%u type=%s ops=%lu ns/op=%.2f\n", side,
+           type_names[k], ops, over_ns);
+    game_free(g);
+}
+
+/* helper function that times copying one board over another */
+void bench_copy(unsigned int side, unsigned int k) {
+    board* b = board_new(side, types[k]);
+    board* dst = board_clone(b);
+    unsigned long ops = 4000000, i;
+    scatter(b);
+    double start = now_ns();
+    for (i = 0; i < ops; i++) {
+        board_copy(dst, b);
+        __asm__ volatile("" : : "r"(dst) : "memory"); /* keep every copy */
+    }
+    double ns = (now_ns() - start) / ops;
+    printf("board_copy side=%u type=%s ops=%lu ns/op=%.1f\n", side,
+           type_names[k], ops, ns);
+    board_free(dst);
+    board_free(b);
+}
+
+/* helper function that times making and freeing games 64 at a time, with
+new_game and game_free and then through an arena */
+void bench_alloc(unsigned int side, unsigned int k) {
+    game* live[64];
+    unsigned long rounds = 20000, i, j;
+    game_arena* a = game_arena_new(side, types[k], 64);
+    if (a == NULL) {
+        fprintf(stderr, "bench_alloc: could not make an arena.\n");
+        exit(1);
+    }
+    double start = now_ns();
+    for (i = 0; i < rounds; i++) {
+        for (j = 0; j < 64; j++) {
+            live[j] = new_game(side, types[k]);
+        }
+        for (j = 0; j < 64; j++) {
+            game_free(live[j]);
+        }
+    }
+    double heap_ns = (now_ns() - start) / (rounds * 64);
+    start = now_ns();
+    for (i = 0; i < rounds; i++) {
+        for (j = 0; j < 64; j++) {
+            live[j] = game_arena_alloc(a);
+        }
+        for (j = 0; j < 64; j++) {
+            game_arena_release(a, live[j]);
+        }
+    }
+    double arena_ns = (now_ns() - start) / (rounds * 64);
+    printf("game_alloc side=%u type=%s ops=%lu new_game_ns=%.1f "
+           "arena_ns=%.1f speedup=%.1f\n", side, type_names[k], rounds * 64,
+           heap_ns, arena_ns, heap_ns / arena_ns);
+    game_arena_free(a);
+}
+
+/* helper function that returns 1 if every board of bb matches its game in
+games: outcome, threat counts, and the state after twisting each board and
+each game the same way */
+int batch_matches(board_batch* bb, game** games, unsigned char* states,
+unsigned char* white, unsigned char* black) {
+    const lines* l = games[0]->lines;
+    int match = 1;
+    batch_outcomes(bb, states);
+    batch_threats(bb, white, black);
+    for (size_t i = 0; i < bb->count; i++) {
+        unsigned int nw = 0, nb = 0;
+        for (unsigned int k = 0; k < l->count; k++) {
+            unsigned char* n = &games[i]->counts[2 * k];
+            nw += (n[1] == l->len - 1) && (n[0] == 0);
+            nb += (n[0] == l->len - 1) && (n[1] == 0);
+        }
+        match = match && states[i] == games[i]->state && white[i] == nw
+                && black[i] == nb;
+    }
+    batch_twist(bb, SE, CCW);
+    batch_outcomes(bb, states);
+    for (size_t i = 0; i < bb->count; i++) {
+        twist_quadrant(games[i], SE, CCW);
+        match = match && states[i] == games[i]->state
+                && bb->black[i] == games[i]->b->u.masks[0]
+                && bb->white[i] == games[i]->b->u.masks[1];
+        twist_quadrant(games[i], SE, CW); /* and back again */
+    }
+    batch_twist(bb, SE, CW);
+    return match;
+}
+
+/* helper function that times batch_outcomes, batch_twist and batch_threats
+on many random positions for every instruction set the processor has,
+checking each lane against its game. the speedups compare against the
+portable kernels and against looping twist_quadrant and game_outcome over
+the games one at a time */
+void bench_batch(unsigned int side) {
+    const char* isas[3] = {"scalar", "sse4", "avx2"};
+    size_t n = 1 << 16, i;
+    unsigned int reps = 16, r, k;
+    board_batch* bb = batch_new(side, n);
+    game** games = (game**)malloc(n * sizeof(game*));
+    unsigned char* states = (unsigned char*)malloc(3 * n);
+    move* ms = (move*)malloc(MAX_MOVES(side) * sizeof(move));
+    if (games == NULL || states == NULL || ms == NULL) {
+        fprintf(stderr, "bench_batch: malloc failed.\n");
+        exit(1);
+    }
+    rng g_rng;
+    rng_seed(&g_rng, side);
+    for (i = 0; i < n; i++) { /* random plies, some games already over */
+        games[i] = new_game(side, MASKS);
+        unsigned int plies = rng_below(&g_rng, side * side);
+        for (unsigned int p = 0; p < plies && !games[i]->state; p++) {
+            make_move(games[i], ms[rng_below(&g_rng,
+                                             generate_moves(games[i], ms))]);
+        }
+        batch_load(bb, i, games[i]);
+    }
+    const char* best = batch_isa();
+    double start = now_ns();
+    unsigned long total = 0;
+    for (r = 0; r < reps; r++) { /* the one-game-at-a-time path */
+        for (i = 0; i < n; i++) {
+            twist_quadrant(games[i], (quadrant)(r & 3),
+                           (direction)((r >> 2) & 1));
+            total += game_outcome(games[i]);
+        }
+    }
+    double games_ns = (now_ns() - start) / ((double)reps * n);
+    sink = total;
+    for (i = 0; i < n; i++) { /* games and lanes must start level again */
+        batch_load(bb, i, games[i]);
+    }
+    double scalar_ns = 0;
+    for (k = 0; k < 3; k++) {
+        if (!batch_use(isas[k])) {
+            continue;
+        }
+        int match = batch_matches(bb, games, states, states + n,
+                                  states + (2 * n));
+        double times[3];
+        start = now_ns();
+        for (r = 0; r < reps; r++) {
+            batch_outcomes(bb, states);
+        }
+        times[0] = (now_ns() - start) / ((double)reps * n);
+        start = now_ns();
+        for (r = 0; r < reps; r++) { /* pairs of twists undo each other */
+            batch_twist(bb, (quadrant)(r & 3), (direction)(r & 1));
+        }
+        times[1] = (now_ns() - start) / ((double)reps * n);
+        start = now_ns();
+        for (r = 0; r < reps; r++) {
+            batch_threats(bb, states + n, states + (2 * n));
+        }
+        times[2] = (now_ns() - start) / ((double)reps * n);
+        if (k == 0) {
+            scalar_ns = times[0] + times[1];
+        }
+        printf("batch side=%u isa=%s boards=%zu outcomes_ns=%.2f "
+               "twist_ns=%.2f threats_ns=%.2f match=%d\n", side, isas[k], n,
+               times[0], times[1], times[2], match);
+        printf("batch_speedup side=%u isa=%s vs_scalar=%.2f vs_games=%.2f\n",
+               side, isas[k], scalar_ns / (times[0] + times[1]),
+               games_ns / (times[0] + times[1]));
+    }
+    batch_use(best);
+    for (i = 0; i < n; i++) {
+        game_free(games[i]);
+    }
+    free(games);
+    free(states);
+    free(ms);
+    batch_free(bb);
+}
+
+/* runs the perft suite and the micro-benchmarks for sides 4, 6 and 8.
+"-depth N" overrides the perft depth and "-side N" benchmarks one side */
+int main(int argc, char *argv[]) {
+    unsigned int depth = 0, only = 0;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-depth") == 0) {
+            depth = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-side") == 0) {
+            only = atoi(argv[i + 1]);
+        }
+    }
+    for (unsigned int side = 4; side <= 8; side += 2) {
+        if (only && side != only) {
+            continue;
+        }
+        /* default depths keep each perft around a second */
+        unsigned int d = depth ? depth : (side == 4) ? 4 : 3;
+        bench_perft(side, "empty", d);
+        bench_perft(side, "middle", d);
+        bench_branching(side, "empty");
+        bench_branching(side, "middle");
+        for (unsigned int k = 0; k < TYPES; k++) {
+            if (types[k] == MASKS && side > 8) {
+                continue;
+            }
+            bench_access(side, k);
+            bench_rotate(side, k);
+            bench_game(side, k);
+            bench_copy(side, k);
+            bench_alloc(side, k);
+        }
+        bench_batch(side);
+        bench_nnue(side);
+        bench_dfpn(side, "empty");
+        bench_dfpn(side, "middle");
+    }
+    return 0;
+}
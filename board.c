@@ -1,74 +1,214 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "board.h"
 
+/* rotation tables for quadrants of side 2 and 3 (boards of side 4 and 6):
+a quadrant is packed into a base 3 number, cell (i, j) being digit
+(i * quad_len) + j, and rotated[quad_len - 2][cw][code] is the packed
+quadrant after the quarter turn */
+static unsigned short rotated[2][2][19683];
+static pthread_once_t rotated_once = PTHREAD_ONCE_INIT;
 
-board* board_new(unsigned int side, enum type type) {
-    board* b = (board*)malloc(sizeof(board));
-    if (b == NULL) {
-        fprintf(stderr, "board_new: malloc failed.\n");
-        exit(1);
+/* helper function that fills the rotation tables, done once even when the
+first small boards are made by several threads */
+static void rotation_tables_init(void) {
+    unsigned int digits[9], n, code, cw, i, j;
+    for (n = 2; n <= 3; n++) {
+        unsigned int codes = (n == 2) ? 81 : 19683;
+        for (code = 0; code < codes; code++) {
+            unsigned int rest = code;
+            for (i = 0; i < n * n; i++) { /* unpack the quadrant */
+                digits[i] = rest % 3;
+                rest /= 3;
+            }
+            for (cw = 0; cw <= 1; cw++) {
+                unsigned int out = 0;
+                for (i = n; i-- > 0;) { /* pack from the last digit down */
+                    for (j = n; j-- > 0;) {
+                        /* same formulas as the quadrant twist: clockwise
+                        (i, j) takes (n-1-j, i), counter-clockwise (j, n-1-i) */
+                        unsigned int from = cw ? ((n - 1 - j) * n) + i
+                                               : (j * n) + (n - 1 - i);
+                        out = (out * 3) + digits[from];
+                    }
+                }
+                rotated[n - 2][cw][code] = (unsigned short)out;
+            }
+        }
     }
+}
+
+
+struct board_kernels;
+
+static const struct board_kernels* kernels_for(unsigned int side,
+                                               enum type type);
+
+/* helper function that returns the bytes needed for the squares buffer of a
+CELLS board kept outside the struct, rounded up to whole cache lines */
+static size_t cells_bytes(unsigned int side) {
+    return (((size_t)side * side) + 63) & ~(size_t)63;
+}
+
+/* helper function that returns the bytes of the row bitsets of a LARGE
+board, BLACK's rows then WHITE's, rounded up to whole cache lines */
+static size_t rows_bytes(unsigned int side) {
+    return ((2 * (size_t)side * sizeof(uint64_t)) + 63) & ~(size_t)63;
+}
+
+/* helper function that returns where a CELLS board keeps its squares */
+static uint8_t* cells_of(board* b) {
+    return (b->side <= BOARD_INLINE_SIDE) ? b->u.squares : b->u.cells;
+}
+
+
+const char* board_invalid(unsigned int side, enum type type) {
     if (side % 2 == 1) { /* board must have side length that is even */
-        fprintf(stderr, "board_new: side must be even.\n");
-        exit(1);
+        return "side must be even";
+    } else if (side < 4) { /* board must have side length of at least four */
+        return "side must be at least four";
+    } else if (type == MASKS && side > 8) { /* one bit per cell in a word */
+        return "MASKS side must be at most eight";
+    } else if (type == LARGE && side > BOARD_LARGE_SIDE) {
+        return "LARGE side must be at most 64";
+    } else if (type != CELLS && type != BITS && type != MASKS
+               && type != LARGE) {
+        return "please enter valid type";
     }
-    if (side < 4) { /* board must have side length of at least four */
-        fprintf(stderr, "board_new: side must be at least four.\n");
-        exit(1);
+    return NULL;
+}
+
+size_t board_outside_bytes(unsigned int side, enum type type) {
+    if (type == CELLS && side > BOARD_INLINE_SIDE) {
+        return cells_bytes(side); /* one aligned block for big boards */
+    } else if (type == BITS) { /* each element stores 16 cells, rounded up */
+        return (((side * side) + 15) / 16) * sizeof(unsigned int);
+    } else if (type == LARGE) {
+        return rows_bytes(side);
+    } else {
+        return 0; /* small CELLS and MASKS boards live in the struct */
     }
+}
+
+void board_init(board* b, unsigned int side, enum type type, void* outside) {
     b->side = side;
     b->type = type;
-    if (type == CELLS) { /* create cells */
-        square** m = (square**)malloc(side * sizeof(square*));
-        if (m == NULL) {
-            fprintf(stderr, "board_new: malloc failed.\n");
-            exit(1);
-        }
-        for (unsigned int i = 0; i < side; i++) {
-            m[i] = (square*)malloc(side * sizeof(square));
-            if (m[i] == NULL) {
-                fprintf(stderr, "board_new: malloc failed.\n");
-                exit(1);
-            }
-            for (unsigned int j = 0; j < side; j++) {
-                m[i][j] = EMPTY; /* cells are intiially empty */
-            }
-        }
-        b->u.cells = m;
-    } else if (type == BITS) { /* create bits */
-        unsigned int cells = side * side, elements;
-        if (cells % 16 == 0) {
-            elements = cells / 16; /* each element stores 16 cells */
-        } else {
-            elements = (cells / 16) + 1; /* round up: store all cells */
-        }
-        unsigned int* a = (unsigned int*)malloc(elements*sizeof(unsigned int));
-        if (a == NULL) {
-            fprintf(stderr, "board_new: malloc failed.\n");
-            exit(1);
-        }
-        for (unsigned int i = 0; i < elements; i++) {
-            a[i] = 0; /* all cells are empty initially */
-        }
-        b->u.bits = a;
-    } else {
-        fprintf(stderr, "board_new: please enter valid type.\n");
+    if (side <= 6 && type != MASKS) {
+        /* built by the first small board */
+        pthread_once(&rotated_once, rotation_tables_init);
+    }
+    if (type == CELLS && side > BOARD_INLINE_SIDE) {
+        b->u.cells = (uint8_t*)outside;
+    } else if (type == BITS) {
+        b->u.bits = (unsigned int*)outside;
+    } else if (type == LARGE) {
+        b->u.rows = (uint64_t*)outside;
+    }
+    b->k = kernels_for(side, type);
+    board_clear(b); /* every cell starts empty */
+}
+
+board* board_new(unsigned int side, enum type type) {
+    const char* invalid = board_invalid(side, type);
+    if (invalid != NULL) {
+        fprintf(stderr, "board_new: %s.\n", invalid);
         exit(1);
     }
+    board* b = (board*)aligned_alloc(_Alignof(board), sizeof(board));
+    size_t bytes = board_outside_bytes(side, type);
+    void* outside = NULL;
+    if (bytes) { /* the BITS array is not a whole number of cache lines */
+        outside = (type == BITS) ? malloc(bytes) : aligned_alloc(64, bytes);
+    }
+    if (b == NULL || (bytes && outside == NULL)) {
+        fprintf(stderr, "board_new: malloc failed.\n");
+        exit(1);
+    }
+    board_init(b, side, type, outside);
     return b;
 }
 
 void board_free(board* b) {
+    if (b->type == CELLS && b->side > BOARD_INLINE_SIDE) {
+        free(b->u.cells);
+    } else if (b->type == BITS) {
+        free(b->u.bits);
+    } else if (b->type == LARGE) {
+        free(b->u.rows);
+    } /* small CELLS and MASKS boards keep everything inside the struct */
+    free(b);
+}
+
+void board_clear(board* b) {
     if (b->type == CELLS) {
-        unsigned int rows = b->side, i;
-        for (i = 0; i < rows; i++) { /* free each row */
-            free(b->u.cells[i]);
+        memset(cells_of(b), EMPTY, b->side * b->side);
+    } else if (b->type == BITS) {
+        memset(b->u.bits, 0, (((b->side * b->side) + 15) / 16)
+                             * sizeof(unsigned int));
+    } else if (b->type == LARGE) {
+        memset(b->u.rows, 0, rows_bytes(b->side));
+    } else {
+        b->u.masks[0] = 0;
+        b->u.masks[1] = 0;
+    }
+    b->hash = 0;
+}
+
+/* helper function that returns the buffer a board keeps outside its
+struct, NULL if it has none */
+static void* outside_buffer(board* b) {
+    if (b->type == CELLS && b->side > BOARD_INLINE_SIDE) {
+        return b->u.cells;
+    } else if (b->type == BITS) {
+        return b->u.bits;
+    } else if (b->type == LARGE) {
+        return b->u.rows;
+    } else {
+        return NULL;
+    }
+}
+
+board* board_clone(board* b) {
+    board* new = (board*)aligned_alloc(_Alignof(board), sizeof(board));
+    size_t bytes = board_outside_bytes(b->side, b->type);
+    if (new == NULL) {
+        fprintf(stderr, "board_clone: malloc failed.\n");
+        exit(1);
+    }
+    memcpy(new, b, sizeof(board));
+    if (bytes) { /* give the clone its own copy of the outside buffer */
+        void* buf = (b->type == BITS) ? malloc(bytes)
+                                      : aligned_alloc(64, bytes);
+        if (buf == NULL) {
+            fprintf(stderr, "board_clone: malloc failed.\n");
+            exit(1);
+        }
+        memcpy(buf, outside_buffer(b), bytes);
+        if (b->type == BITS) {
+            new->u.bits = (unsigned int*)buf;
+        } else if (b->type == LARGE) {
+            new->u.rows = (uint64_t*)buf;
+        } else {
+            new->u.cells = (uint8_t*)buf;
         }
-    } else { /* type is BITS */
-        free(b->u.bits);
     }
-    free(b);
+    return new;
+}
+
+void board_copy(board* dst, board* src) {
+    if (dst->side != src->side || dst->type != src->type) {
+        fprintf(stderr, "board_copy: boards must match in side and type.\n");
+        exit(1);
+    }
+    size_t bytes = board_outside_bytes(src->side, src->type);
+    if (!bytes) {
+        memcpy(dst, src, sizeof(board));
+    } else {
+        memcpy(outside_buffer(dst), outside_buffer(src), bytes);
+        dst->hash = src->hash;
+    }
 }
 
 /* helper function to assign the proper label for headers using ASCII values */
@@ -131,57 +271,384 @@ void board_show(board* b) {
     printf("\n");
 }
 
-square board_get(board* b, pos p) {
-    if ((p.r >= b->side) || (p.c >= b->side)) {
-        fprintf(stderr, "board_get: position out of bounds.\n");
+/* masks for MASKS boards of side 4, 6 and 8. quadrant masks are given for NW
+and shifted left by the quadrant's first bit for the other quadrants */
+struct mask_table {
+    uint64_t transpose[3]; /* cells (i, i + k + 1): swapped across diagonal */
+    uint64_t rows[2];      /* row i: swapped with row quad_len - 1 - i */
+    uint64_t cols[2];      /* column j: swapped with column quad_len - 1 - j */
+};
+
+static const struct mask_table mask_tables[3] = {
+    { /* side 4 */
+        {0x2, 0, 0}, {0x3, 0}, {0x11, 0}
+    },
+    { /* side 6 */
+        {0x102, 0x4, 0}, {0x7, 0}, {0x1041, 0}
+    },
+    { /* side 8 */
+        {0x80402, 0x804, 0x8}, {0xf, 0xf00}, {0x1010101, 0x2020202}
+    }
+};
+
+/* helper function that exchanges the bits selected by mask with the bits
+delta places above them */
+static uint64_t delta_swap(uint64_t x, uint64_t mask, unsigned int delta) {
+    uint64_t t = ((x >> delta) ^ x) & mask;
+    return x ^ t ^ (t << delta);
+}
+
+/* helper function that rotates one occupancy word: a transpose followed by
+mirroring the columns is clockwise, mirroring the rows is counter-clockwise */
+static uint64_t rotate_word(uint64_t x, const struct mask_table* t,
+unsigned int side, unsigned int shift, int cw) {
+    unsigned int quad_len = side / 2, i;
+    for (i = 0; i + 1 < quad_len; i++) {
+        x = delta_swap(x, t->transpose[i] << shift, (i + 1) * (side - 1));
+    }
+    for (i = 0; i < quad_len / 2; i++) {
+        if (cw) {
+            x = delta_swap(x, t->cols[i] << shift, quad_len - 1 - (2 * i));
+        } else {
+            x = delta_swap(x, t->rows[i] << shift,
+                           (quad_len - 1 - (2 * i)) * side);
+        }
+    }
+    return x;
+}
+
+unsigned int board_swaps(unsigned int side, pos p, int cw, uint64_t* masks,
+unsigned int* deltas) {
+    if (side > 8 || side < 4 || side % 2 != 0) {
+        fprintf(stderr, "board_swaps: side must be 4, 6 or 8.\n");
         exit(1);
     }
-    if (b->type == BITS) {
+    const struct mask_table* t = &mask_tables[(side / 2) - 2];
+    unsigned int quad_len = side / 2, shift = (p.r * side) + p.c, n = 0, i;
+    for (i = 0; i + 1 < quad_len; i++) { /* same steps as rotate_word */
+        masks[n] = t->transpose[i] << shift;
+        deltas[n++] = (i + 1) * (side - 1);
+    }
+    for (i = 0; i < quad_len / 2; i++) {
+        masks[n] = (cw ? t->cols[i] : t->rows[i]) << shift;
+        deltas[n++] = cw ? quad_len - 1 - (2 * i)
+                         : (quad_len - 1 - (2 * i)) * side;
+    }
+    return n;
+}
+
+/* the kernels below are written once over side and type and instantiated
+by BOARD_KERNELS. each instance passes constants, so after inlining the
+type dispatch, the cell arithmetic, the quad_len loops and the mask table
+lookup all fold away. the generic instance passes the board's own fields
+and handles every other even side */
+#define KERNEL static inline __attribute__((always_inline))
+
+/* helper kernel that returns the square at p */
+KERNEL square cell_get(board* b, pos p, unsigned int side, enum type type) {
+    if (type == MASKS) {
+        uint64_t bit = (uint64_t)1 << ((p.r * side) + p.c);
+        if (b->u.masks[0] & bit) {
+            return BLACK;
+        } else if (b->u.masks[1] & bit) {
+            return WHITE;
+        } else {
+            return EMPTY;
+        }
+    } else if (type == LARGE) {
+        uint64_t bit = (uint64_t)1 << p.c;
+        if (b->u.rows[p.r] & bit) {
+            return BLACK;
+        } else if (b->u.rows[side + p.r] & bit) {
+            return WHITE;
+        } else {
+            return EMPTY;
+        }
+    } else if (type == BITS) {
         /* cell_num = the cell that pos p points to;
         index = which int in the list the cell's information is in;
         bit_num = which two bits in the int contains the cell's information
         sq = just the two bits containing the cell's information */
-        unsigned int cell_num = (p.c * b->side) + p.r;
+        unsigned int cell_num = (p.c * side) + p.r;
         unsigned int index = cell_num / 16, bit_num = cell_num % 16;
         unsigned int sq = (b->u.bits[index] >> (bit_num * 2)) & 3;
-        switch (sq) {
-            case 0:
-                return EMPTY;
-            case 1:
-                return BLACK;
-            default: /* sq = 2 */
-                return WHITE;
+        return (sq == 0) ? EMPTY : (sq == 1) ? BLACK : WHITE;
+    } else {
+        uint8_t* cells = (side <= BOARD_INLINE_SIDE) ? b->u.squares
+                                                     : b->u.cells;
+        return (square)cells[(p.r * side) + p.c];
+    }
+}
+
+/* helper kernel that stores s at p and updates the hash */
+KERNEL void cell_set(board* b, pos p, square s, unsigned int side,
+enum type type) {
+    unsigned int cell = (p.r * side) + p.c;
+    b->hash ^= board_key(cell, cell_get(b, p, side, type))
+             ^ board_key(cell, s);
+    if (type == MASKS) {
+        uint64_t bit = (uint64_t)1 << cell;
+        b->u.masks[0] &= ~bit; /* clear the cell, then mark its colour */
+        b->u.masks[1] &= ~bit;
+        if (s != EMPTY) {
+            b->u.masks[s - 1] |= bit; /* BLACK = 1, WHITE = 2 */
         }
+    } else if (type == LARGE) {
+        uint64_t bit = (uint64_t)1 << p.c;
+        b->u.rows[p.r] &= ~bit;
+        b->u.rows[side + p.r] &= ~bit;
+        if (s != EMPTY) {
+            b->u.rows[((s - 1) * side) + p.r] |= bit;
+        }
+    } else if (type == BITS) {
+        unsigned int sq = (s == EMPTY) ? 0 : (s == BLACK) ? 1 : 2;
+        /* cell_num, index, bit_num: same definitions as in cell_get */
+        unsigned int cell_num = (p.c * side) + p.r;
+        unsigned int index = cell_num / 16, bit_num = cell_num % 16;
+        /* strategy: set the two bits first to 00 and then update */
+        unsigned int empty_cell = (b->u.bits[index]) & (~(3 << (bit_num * 2)));
+        b->u.bits[index] = empty_cell | (sq << (bit_num * 2)); /* update */
     } else {
-        return b->u.cells[p.r][p.c];
+        uint8_t* cells = (side <= BOARD_INLINE_SIDE) ? b->u.squares
+                                                     : b->u.cells;
+        cells[cell] = (uint8_t)s;
+    }
+}
+
+/* helper kernel that rotates both occupancy words of a MASKS board, then
+toggles the key of every bit that flipped */
+KERNEL void rotate_masks(board* b, pos p, int cw, unsigned int side) {
+    const struct mask_table* t = &mask_tables[(side / 2) - 2];
+    unsigned int shift = (p.r * side) + p.c;
+    for (unsigned int k = 0; k <= 1; k++) { /* BLACK, then WHITE */
+        uint64_t old = b->u.masks[k];
+        b->u.masks[k] = rotate_word(old, t, side, shift, cw);
+        uint64_t changed = old ^ b->u.masks[k];
+        while (changed) { /* every flipped bit toggles its key */
+            unsigned int cell = __builtin_ctzll(changed);
+            b->hash ^= board_key(cell, (square)(k + 1));
+            changed &= changed - 1;
+        }
+    }
+}
+
+/* helper function that transposes the 32x32 bit matrix whose row i is a[i]
+and column j bit j, swapping ever smaller blocks across the diagonal */
+static void transpose32(uint32_t* a) {
+    uint32_t m = 0x0000ffff;
+    for (unsigned int j = 16; j != 0; j >>= 1, m ^= m << j) {
+        for (unsigned int k = 0; k < 32; k = ((k | j) + 1) & ~j) {
+            uint32_t t = ((a[k] >> j) ^ a[k | j]) & m;
+            a[k | j] ^= t;
+            a[k] ^= t << j;
+        }
     }
 }
 
+/* helper function that rotates the quadrant at p of a LARGE board a word at
+a time: clockwise reverses the row order then transposes, counter-clockwise
+transposes then reverses the row order. only the cells that change colour
+touch the hash */
+static void rotate_rows(board* b, pos p, int cw) {
+    unsigned int side = b->side, n = side / 2, i, k;
+    uint64_t mask = (((uint64_t)1 << n) - 1) << p.c;
+    for (k = 0; k <= 1; k++) { /* BLACK, then WHITE */
+        uint64_t* rows = &b->u.rows[(k * side) + p.r];
+        uint32_t q[32] = {0};
+        for (i = 0; i < n; i++) {
+            q[cw ? n - 1 - i : i] = (uint32_t)((rows[i] & mask) >> p.c);
+        }
+        transpose32(q);
+        for (i = 0; i < n; i++) {
+            uint64_t old = rows[i];
+            rows[i] = (old & ~mask) | ((uint64_t)q[cw ? i : n - 1 - i] << p.c);
+            uint64_t changed = old ^ rows[i];
+            while (changed) { /* every flipped bit toggles its key */
+                unsigned int c = __builtin_ctzll(changed);
+                b->hash ^= board_key(((p.r + i) * side) + c, (square)(k + 1));
+                changed &= changed - 1;
+            }
+        }
+    }
+}
+
+/* helper kernel that rotates a quadrant of side 2 or 3 through the lookup
+table, writing back only the cells that changed */
+KERNEL void rotate_table(board* b, pos p, int cw, unsigned int side,
+enum type type) {
+    unsigned int n = side / 2, code = 0, i, j;
+    for (i = n; i-- > 0;) {
+        for (j = n; j-- > 0;) {
+            code = (code * 3)
+                 + cell_get(b, make_pos(p.r + i, p.c + j), side, type);
+        }
+    }
+    unsigned int out = rotated[n - 2][cw != 0][code];
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            if (out % 3 != code % 3) {
+                cell_set(b, make_pos(p.r + i, p.c + j), (square)(out % 3),
+                         side, type);
+            }
+            out /= 3;
+            code /= 3;
+        }
+    }
+}
+
+/* helper kernel that rotates a quadrant of any size in place, moving each
+ring of four cells round by one */
+KERNEL void rotate_cycles(board* b, pos p, int cw, unsigned int side,
+enum type type) {
+    unsigned int n = side / 2, i, j;
+    for (i = 0; i < n / 2; i++) {
+        for (j = 0; j < (n + 1) / 2; j++) {
+            pos a = make_pos(p.r + i, p.c + j);
+            pos e = make_pos(p.r + j, p.c + n - 1 - i);
+            pos c = make_pos(p.r + n - 1 - i, p.c + n - 1 - j);
+            pos d = make_pos(p.r + n - 1 - j, p.c + i);
+            square t = cell_get(b, a, side, type);
+            if (cw) { /* a <- d <- c <- e <- a */
+                cell_set(b, a, cell_get(b, d, side, type), side, type);
+                cell_set(b, d, cell_get(b, c, side, type), side, type);
+                cell_set(b, c, cell_get(b, e, side, type), side, type);
+                cell_set(b, e, t, side, type);
+            } else { /* a <- e <- c <- d <- a */
+                cell_set(b, a, cell_get(b, e, side, type), side, type);
+                cell_set(b, e, cell_get(b, c, side, type), side, type);
+                cell_set(b, c, cell_get(b, d, side, type), side, type);
+                cell_set(b, d, t, side, type);
+            }
+        }
+    }
+}
+
+/* helper kernel for board_rotate */
+KERNEL void quadrant_rotate(board* b, pos p, int cw, unsigned int side,
+enum type type) {
+    if (type == MASKS) {
+        rotate_masks(b, p, cw, side);
+    } else if (type == LARGE) {
+        rotate_rows(b, p, cw);
+    } else if (side <= 6) {
+        rotate_table(b, p, cw, side, type);
+    } else {
+        rotate_cycles(b, p, cw, side, type);
+    }
+}
+
+/* one set of kernels, bound to a side and type by board_new */
+struct board_kernels {
+    square (*get)(board* b, pos p);
+    void (*set)(board* b, pos p, square s);
+    void (*rotate)(board* b, pos p, int cw);
+};
+
+/* instantiates the kernels for one side and type as name */
+#define BOARD_KERNELS(name, side, type) \
+static square get_##name(board* b, pos p) { \
+    return cell_get(b, p, side, type); \
+} \
+static void set_##name(board* b, pos p, square s) { \
+    cell_set(b, p, s, side, type); \
+} \
+static void rotate_##name(board* b, pos p, int cw) { \
+    quadrant_rotate(b, p, cw, side, type); \
+} \
+static const struct board_kernels name = {get_##name, set_##name, \
+                                          rotate_##name};
+
+BOARD_KERNELS(cells_4, 4, CELLS)
+BOARD_KERNELS(cells_6, 6, CELLS)
+BOARD_KERNELS(cells_8, 8, CELLS)
+BOARD_KERNELS(bits_4, 4, BITS)
+BOARD_KERNELS(bits_6, 6, BITS)
+BOARD_KERNELS(bits_8, 8, BITS)
+BOARD_KERNELS(masks_4, 4, MASKS)
+BOARD_KERNELS(masks_6, 6, MASKS)
+BOARD_KERNELS(masks_8, 8, MASKS)
+BOARD_KERNELS(large, b->side, LARGE)
+BOARD_KERNELS(generic, b->side, b->type)
+
+/* the specialised kernels by type and side 4, 6 or 8 */
+static const struct board_kernels* const dispatch[3][3] = {
+    {&cells_4, &cells_6, &cells_8},
+    {&bits_4, &bits_6, &bits_8},
+    {&masks_4, &masks_6, &masks_8}
+};
+
+/* helper function that picks the kernels for a new board */
+static const struct board_kernels* kernels_for(unsigned int side,
+enum type type) {
+    if (type == LARGE) {
+        return &large;
+    } else if (side == 4 || side == 6 || side == 8) {
+        return dispatch[type][(side / 2) - 2];
+    }
+    return &generic;
+}
+
+square board_get(board* b, pos p) {
+    if ((p.r >= b->side) || (p.c >= b->side)) {
+        fprintf(stderr, "board_get: position out of bounds.\n");
+        exit(1);
+    }
+    return b->k->get(b, p);
+}
+
 void board_set(board* b, pos p, square s) {
     if ((p.r >= b->side) || (p.c >= b->side)) {
         fprintf(stderr, "board_set: position out of bounds.\n");
         exit(1);
     }
-    if (b->type == BITS) {
-        unsigned int sq; /* represents the state of the cell */
-        switch (s) {
-            case EMPTY:
-                sq = 0;
-                break;
-            case BLACK:
-                sq = 1;
-                break;
-            default:
-                sq = 2;
-                break;
-        }
-        /* cell_num, index, bit_num: same definitions as in board_get */
-        unsigned int cell_num = (p.c * b->side) + p.r;
-        unsigned int index = cell_num / 16, bit_num = cell_num % 16;
-        /* strategy: set the two bits first to 00 and then update */
-        unsigned int empty_cell = (b->u.bits[index]) & (~(3 << (bit_num * 2)));
-        b->u.bits[index] = empty_cell | (sq << (bit_num * 2)); /* update */
-    } else { /* type is cells */
-        b->u.cells[p.r][p.c] = s;
+    b->k->set(b, p, s);
+}
+
+void board_rotate(board* b, pos p, int cw) {
+    b->k->rotate(b, p, cw);
+}
+
+uint64_t board_key(unsigned int cell, square s) {
+    if (s == EMPTY) {
+        return 0;
+    }
+    /* splitmix64 finaliser over the (cell, colour) pair */
+    uint64_t z = (((uint64_t)cell << 1) + s) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+pos board_symmetry(pos p, unsigned int side, unsigned int sym) {
+    for (unsigned int k = 0; k < sym % 4; k++) { /* (r, c) -> (c, side-1-r) */
+        p = make_pos(p.c, side - 1 - p.r);
+    }
+    if (sym >= 4) {
+        p.c = side - 1 - p.c;
+    }
+    return p;
+}
+
+uint64_t board_canonical_hash(board* b, unsigned int* sym) {
+    uint64_t hashes[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    unsigned int side = b->side, t, best = 0;
+    for (unsigned int cell = 0; cell < side * side; cell++) {
+        pos p = make_pos(cell / side, cell % side);
+        square s = board_get(b, p);
+        if (s == EMPTY) {
+            continue;
+        }
+        hashes[0] ^= board_key(cell, s);
+        for (t = 1; t < 8; t++) {
+            pos q = board_symmetry(p, side, t);
+            hashes[t] ^= board_key((q.r * side) + q.c, s);
+        }
+    }
+    for (t = 1; t < 8; t++) {
+        if (hashes[t] < hashes[best]) {
+            best = t;
+        }
     }
+    *sym = best;
+    return hashes[best];
 }
@@ -1,6 +1,8 @@
 #ifndef _BOARD_H
 #define _BOARD_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include "pos.h"
 
 
@@ -13,40 +15,115 @@ enum square {
 typedef enum square square;
 
 
+/* CELLS boards up to this side keep their squares inside the board struct,
+so the whole position sits in two cache lines */
+#define BOARD_INLINE_SIDE 8
+
+/* largest side of a LARGE board, one word per row */
+#define BOARD_LARGE_SIDE 64
+
 union board_rep {
-    enum square** cells;
+    uint8_t* cells;    /* CELLS: side * side squares, row-major */
     unsigned int* bits;
+    uint64_t masks[2]; /* MASKS: BLACK then WHITE, bit (r * side) + c */
+    uint64_t* rows;    /* LARGE: BLACK's side rows then WHITE's, bit c */
+    _Alignas(64) uint8_t squares[BOARD_INLINE_SIDE * BOARD_INLINE_SIDE];
+                       /* CELLS boards with side <= BOARD_INLINE_SIDE */
 };
 
 typedef union board_rep board_rep;
 
 enum type {
-    CELLS, BITS
+    CELLS, BITS, MASKS, LARGE
 };
 
 
+struct board_kernels;
+
 struct board {
     unsigned int side;
     enum type type;
+    uint64_t hash;  /* Zobrist hash: xor of board_key over occupied cells */
+    const struct board_kernels* k; /* get, set and rotate for this side and
+                                      type, compiled for sides 4, 6, 8 */
     board_rep u;
 };
 
 typedef struct board board;
 
-/* constructs an empty board of inputted size (must be even) */
+/* constructs an empty board of inputted size (must be even). sides 4, 6
+and 8 get kernels built for that side, with constant loop bounds and masks,
+other sides a generic version */
 board* board_new(unsigned int side, enum type type);
 
-/* frees an inputted board, also frees the two dimensional squares array for
-CELLS, frees the unsigned int array for BITS */
+/* returns why a board of inputted side and type cannot be made, or NULL
+if it can */
+const char* board_invalid(unsigned int side, enum type type);
+
+/* returns the bytes of the buffer a board of inputted side and type keeps
+outside its struct, 0 if it keeps none */
+size_t board_outside_bytes(unsigned int side, enum type type);
+
+/* sets up an empty board in storage the caller owns: b itself and outside,
+a buffer of board_outside_bytes bytes or NULL if that is 0. side and type
+must pass board_invalid. the board must not be passed to board_free */
+void board_init(board* b, unsigned int side, enum type type, void* outside);
+
+/* frees an inputted board, also frees the squares buffer of large CELLS
+boards and the unsigned int array for BITS */
 void board_free(board* b);
 
+/* empties every cell of a board in place */
+void board_clear(board* b);
+
+/* makes a new board holding the same position as b */
+board* board_clone(board* b);
+
+/* overwrites dst with the position of src, both must have the same side and
+type. a single memcpy unless the board keeps its squares outside the struct */
+void board_copy(board* dst, board* src);
+
+/* returns the character labelling row or column i in board_show */
+char get_label(unsigned int i);
+
 /* prints out an inputted board, displaying the marbles and rows/columns */
 void board_show(board* b);
 
 /* returns the state (tag) of a certain cell in the board */
 square board_get(board* b, pos p);
 
-/* sets a certain cell in the board to a specified state (tag) */
+/* sets a certain cell in the board to a specified state (tag), keeping the
+board's Zobrist hash up to date */
 void board_set(board* b, pos p, square s);
 
+/* returns the Zobrist key of cell number (r * side) + c holding s, 0 for
+EMPTY. keys are fixed, so equal positions hash equally across boards */
+uint64_t board_key(unsigned int cell, square s);
+
+/* maps p through one of the 8 symmetries of a board of inputted side:
+sym % 4 clockwise quarter turns of the whole board, then a left-right
+mirror if sym >= 4 */
+pos board_symmetry(pos p, unsigned int side, unsigned int sym);
+
+/* returns the smallest Zobrist hash over the 8 symmetric images of the
+board, storing which symmetry gave it in sym */
+uint64_t board_canonical_hash(board* b, unsigned int* sym);
+
+/* rotates the side/2 block whose top-left corner is p a quarter turn,
+clockwise if cw is nonzero and counter-clockwise otherwise, keeping the
+hash up to date. never allocates:
+MASKS boards swap bits, sides 4 and 6 use lookup tables and larger sides
+move the cells round in rings of four */
+void board_rotate(board* b, pos p, int cw);
+
+/* most delta swaps board_swaps can return */
+#define BOARD_MAX_SWAPS 5
+
+/* writes the delta swaps that rotate the quadrant at top-left corner p of a
+bit mask of inputted side (4, 6 or 8) the way MASKS boards do: swap the
+bits in masks[i] with the ones deltas[i] places above them, in order.
+returns the number of swaps, at most BOARD_MAX_SWAPS */
+unsigned int board_swaps(unsigned int side, pos p, int cw, uint64_t* masks,
+                         unsigned int* deltas);
+
 #endif /* _BOARD_H */
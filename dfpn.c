@@ -0,0 +1,494 @@
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dfpn.h"
+
+/* proof and disproof numbers saturate here, which means solved */
+#define PN_INF UINT32_MAX
+
+/* slots per bucket of the proof table */
+#define PN_BUCKET 4
+
+/* the table is collected once more than this many 64ths of it are used,
+down to half */
+#define GC_AT 56
+
+/* expanded nodes between looks at the clock */
+#define TICK_NODES 1024
+
+/* keys of the second pass, whether the opponent wins, are salted with this
+so they never meet those of the first */
+#define SECOND_PASS_SALT 0x9e3779b97f4a7c15UL
+
+#define CHECKPOINT_MAGIC "PTPN"
+#define CHECKPOINT_VERSION 1
+
+/* one proven, disproven or partly searched position, numbers from the
+point of view of the side trying to win in this pass */
+struct pn_entry {
+    uint64_t key;     /* 0 for an empty slot */
+    uint32_t pn, dn;
+    uint32_t work;    /* nodes expanded under it, saturating */
+};
+
+/* a checkpoint file starts with this, then holds the used slots */
+struct checkpoint_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t side;
+    uint32_t pass;
+    uint64_t root;    /* game_hash of the position being proven */
+    uint64_t nodes;
+    uint64_t proven;
+    double seconds;
+    uint64_t entries;
+    uint64_t reserved;
+};
+
+struct dfpn {
+    game* g;
+    dfpn_options* opts;
+    unsigned int max_moves;
+    struct pn_entry* table;
+    size_t buckets;        /* a power of two */
+    size_t used;
+    unsigned long collections;
+    move* moves;           /* max_moves per ply */
+    uint32_t* cpn;         /* the numbers of those moves' positions */
+    uint32_t* cdn;
+    unsigned int pass;     /* 1: does the mover win, 2: does the opponent */
+    turn attacker;         /* the side trying to win in this pass */
+    uint64_t salt;
+    uint64_t root;
+    unsigned long nodes, proven, first_node;
+    double start, seconds_before;
+    double next_report, next_checkpoint;
+    unsigned long report_nodes, report_proven;
+    double report_time;
+    uint32_t root_pn, root_dn;
+    int stopped;
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+/* helper function that asks the proof to save and stop */
+static void interrupt(int sig) {
+    (void)sig;
+    interrupted = 1;
+}
+
+/* helper function that returns monotonic time in seconds */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/* helper function that returns the table key of the position of g. on
+boards with fewer marbles than the side, where symmetric positions meet
+often, it is the hash over the symmetry group; further on the plain hash,
+which costs nothing, saves more than the rare symmetric meetings would */
+static uint64_t key_of(struct dfpn* s) {
+    game* g = s->g;
+    unsigned int sym;
+    uint64_t key = (g->filled < g->b->side) ? game_canonical_hash(g, &sym)
+                                            : game_hash(g);
+    key ^= s->salt;
+    return (key != 0) ? key : 1; /* 0 marks an empty slot */
+}
+
+/* helper function that returns the slot holding key, or NULL */
+static struct pn_entry* find(struct dfpn* s, uint64_t key) {
+    struct pn_entry* b = &s->table[(key & (s->buckets - 1)) * PN_BUCKET];
+    for (unsigned int i = 0; i < PN_BUCKET; i++) {
+        if (b[i].key == key) {
+            return &b[i];
+        }
+    }
+    return NULL;
+}
+
+/* helper function that returns the size class of an entry for collection:
+solved entries above every unsolved one, then by the bits of work */
+static unsigned int size_class(const struct pn_entry* e) {
+    unsigned int bits = e->work ? 32 - __builtin_clz(e->work) : 0;
+    return ((e->pn == 0 || e->dn == 0) ? 33 : 0) + bits;
+}
+
+/* helper function that empties the table down to half full, dropping the
+entries of the smallest size classes: the positions cheapest to search
+again, whose loss costs least */
+static void collect(struct dfpn* s) {
+    size_t counts[66], slots = s->buckets * PN_BUCKET, i, dropped = 0;
+    size_t target = slots / 2;
+    unsigned int cut;
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < slots; i++) {
+        if (s->table[i].key != 0) {
+            counts[size_class(&s->table[i])]++;
+        }
+    }
+    for (cut = 0; cut < 65 && s->used - dropped > target; cut++) {
+        dropped += counts[cut];
+    }
+    for (i = 0; i < slots; i++) { /* every class below cut goes */
+        if (s->table[i].key != 0 && size_class(&s->table[i]) < cut) {
+            s->table[i].key = 0;
+        }
+    }
+    s->used -= dropped;
+    s->collections++;
+}
+
+/* helper function that records the numbers of the position with key */
+static void store(struct dfpn* s, uint64_t key, uint32_t pn, uint32_t dn,
+unsigned long work) {
+    struct pn_entry* e = find(s, key);
+    if (e == NULL) {
+        if (s->used * 64 >= s->buckets * PN_BUCKET * GC_AT) {
+            collect(s);
+        }
+        struct pn_entry* b = &s->table[(key & (s->buckets - 1)) * PN_BUCKET];
+        for (unsigned int i = 0; i < PN_BUCKET; i++) {
+            if (b[i].key == 0) {
+                e = &b[i];
+                s->used++;
+                break;
+            } else if (e == NULL || size_class(&b[i]) < size_class(e)) {
+                e = &b[i]; /* replaced if no slot is empty */
+            }
+        }
+    }
+    e->key = key;
+    e->pn = pn, e->dn = dn;
+    e->work = (work < UINT32_MAX) ? (uint32_t)work : UINT32_MAX;
+}
+
+/* helper function that writes the table to the checkpoint file, through a
+temporary file renamed over it so a crash mid-write loses nothing */
+static void save(struct dfpn* s) {
+    const char* path = s->opts->checkpoint;
+    size_t room = strlen(path) + 5, slots = s->buckets * PN_BUCKET, i;
+    char* tmp = (char*)malloc(room);
+    if (tmp == NULL) {
+        fprintf(stderr, "dfpn_solve: malloc failed.\n");
+        exit(1);
+    }
+    snprintf(tmp, room, "%s.tmp", path);
+    FILE* f = fopen(tmp, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "dfpn_solve: could not write %s.\n", tmp);
+        free(tmp);
+        return; /* carry on, the next checkpoint may work */
+    }
+    struct checkpoint_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CHECKPOINT_MAGIC, 4);
+    h.version = CHECKPOINT_VERSION;
+    h.side = s->g->b->side;
+    h.pass = s->pass;
+    h.root = s->root;
+    h.nodes = s->nodes, h.proven = s->proven;
+    h.seconds = s->seconds_before + (now_seconds() - s->start);
+    h.entries = s->used;
+    int ok = (fwrite(&h, sizeof(h), 1, f) == 1);
+    for (i = 0; ok && i < slots; i++) {
+        if (s->table[i].key != 0) {
+            ok = (fwrite(&s->table[i], sizeof(struct pn_entry), 1, f) == 1);
+        }
+    }
+    if (fclose(f) != 0 || !ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "dfpn_solve: could not write %s.\n", path);
+        remove(tmp);
+    }
+    free(tmp);
+}
+
+/* helper function that carries on from the checkpoint file, if there is
+one. exits if it belongs to another position */
+static void load(struct dfpn* s) {
+    FILE* f = fopen(s->opts->checkpoint, "rb");
+    if (f == NULL) {
+        return; /* a fresh start */
+    }
+    struct checkpoint_header h;
+    if (fread(&h, sizeof(h), 1, f) != 1
+        || memcmp(h.magic, CHECKPOINT_MAGIC, 4) != 0
+        || h.version != CHECKPOINT_VERSION || (h.pass != 1 && h.pass != 2)) {
+        fprintf(stderr, "dfpn_solve: %s is not a checkpoint.\n",
+                s->opts->checkpoint);
+        exit(1);
+    } else if (h.side != s->g->b->side || h.root != s->root) {
+        fprintf(stderr, "dfpn_solve: %s is for another position.\n",
+                s->opts->checkpoint);
+        exit(1);
+    }
+    s->pass = h.pass;
+    s->nodes = h.nodes, s->proven = h.proven;
+    s->seconds_before = h.seconds;
+    struct pn_entry e;
+    for (uint64_t i = 0; i < h.entries; i++) {
+        if (fread(&e, sizeof(e), 1, f) != 1) {
+            fprintf(stderr, "dfpn_solve: %s is cut short.\n",
+                    s->opts->checkpoint);
+            exit(1);
+        }
+        store(s, e.key, e.pn, e.dn, e.work);
+    }
+    fclose(f);
+}
+
+/* helper function that writes a proof or disproof number to out, which
+needs room for 11 characters */
+static void format_number(uint32_t n, char* out) {
+    if (n == PN_INF) {
+        strcpy(out, "inf");
+    } else {
+        snprintf(out, 11, "%u", n);
+    }
+}
+
+/* helper function that prints a progress line: rates since the last one,
+the root's numbers and how full the table is */
+static void report(struct dfpn* s, double now) {
+    double span = now - s->report_time;
+    char pn[11], dn[11];
+    if (span <= 0) {
+        span = 1e-9;
+    }
+    format_number(s->root_pn, pn);
+    format_number(s->root_dn, dn);
+    printf("dfpn pass=%u nodes=%lu proven=%lu nodes/s=%.0f proven/s=%.0f "
+           "pn=%s dn=%s table=%.1f%% gc=%lu\n", s->pass, s->nodes,
+           s->proven, (s->nodes - s->report_nodes) / span,
+           (s->proven - s->report_proven) / span, pn, dn,
+           100.0 * s->used / (s->buckets * PN_BUCKET), s->collections);
+    fflush(stdout);
+    s->report_nodes = s->nodes, s->report_proven = s->proven;
+    s->report_time = now;
+}
+
+/* helper function run every TICK_NODES nodes: reports, saves, and stops
+on an interrupt */
+static void tick(struct dfpn* s) {
+    dfpn_options* o = s->opts;
+    double now = now_seconds();
+    if (interrupted) {
+        s->stopped = 1;
+    }
+    if (o->report_s && now >= s->next_report) {
+        report(s, now);
+        s->next_report = now + o->report_s;
+    }
+    if (o->checkpoint != NULL && now >= s->next_checkpoint) {
+        save(s);
+        s->next_checkpoint = now_seconds() + o->checkpoint_s;
+    }
+}
+
+/* helper function that gives the numbers of the position of g, just
+reached: exact if the game is over, stored if it was searched before, and
+otherwise solved already if the mover wins by a placement, else 1 and 1 */
+static void leaf_numbers(struct dfpn* s, uint32_t* pn, uint32_t* dn) {
+    game* g = s->g;
+    int won; /* by the attacker */
+    if (g->state != 0) {
+        won = (g->state == ((s->attacker == WHITE_NEXT) ? 1 : 2));
+    } else {
+        struct pn_entry* e = find(s, key_of(s));
+        if (e != NULL) {
+            *pn = e->pn, *dn = e->dn;
+            return;
+        } else if (!can_win_by_placement(g)) {
+            *pn = 1, *dn = 1;
+            return;
+        }
+        won = (g->next == s->attacker);
+    }
+    *pn = won ? 0 : PN_INF;
+    *dn = won ? PN_INF : 0;
+}
+
+/* helper function that searches the position of g, ply plies below the
+root, until its proof number reaches th_pn or its disproof number th_dn,
+and stores and returns both. the player to move picks the move with the
+least of its own number (proof if it is the attacker, disproof if not),
+and its number is the least of theirs while the other is their sum. the
+chosen move is searched until it passes the second best by a quarter, so
+the search does not flit between two close moves */
+static void mid(struct dfpn* s, unsigned int ply, uint32_t th_pn,
+uint32_t th_dn, uint32_t* out_pn, uint32_t* out_dn) {
+    game* g = s->g;
+    uint64_t key = key_of(s);
+    unsigned long first = s->nodes++;
+    unsigned long max_nodes = s->opts->max_nodes;
+    if (max_nodes && s->nodes - s->first_node >= max_nodes) {
+        s->stopped = 1; /* exactly on the budget, not at the next tick */
+    }
+    if (s->nodes % TICK_NODES == 0) {
+        tick(s);
+    }
+    move* ms = &s->moves[ply * s->max_moves];
+    uint32_t* cpn = &s->cpn[ply * s->max_moves];
+    uint32_t* cdn = &s->cdn[ply * s->max_moves];
+    unsigned int n = generate_unique_moves(g, ms, 0), i;
+    for (i = 0; i < n; i++) {
+        make_move(g, ms[i]);
+        leaf_numbers(s, &cpn[i], &cdn[i]);
+        unmake_move(g, ms[i]);
+    }
+    int attacking = (g->next == s->attacker);
+    uint32_t* mine = attacking ? cpn : cdn;   /* the mover's numbers */
+    uint32_t* theirs = attacking ? cdn : cpn; /* summed */
+    uint32_t th_mine = attacking ? th_pn : th_dn;
+    uint32_t th_theirs = attacking ? th_dn : th_pn;
+    uint32_t least, total;
+    while (1) {
+        unsigned int best = 0;
+        uint32_t second = PN_INF;
+        uint64_t sum = theirs[0];
+        for (i = 1; i < n; i++) {
+            if (mine[i] < mine[best]) {
+                second = mine[best];
+                best = i;
+            } else if (mine[i] < second) {
+                second = mine[i];
+            }
+            sum += theirs[i];
+        }
+        int solved = 0; /* the sum is infinite only if a term is */
+        for (i = 0; i < n && !solved; i++) {
+            solved = (theirs[i] == PN_INF);
+        }
+        least = mine[best];
+        total = solved ? PN_INF : (sum < PN_INF) ? (uint32_t)sum : PN_INF - 1;
+        if (ply == 0) {
+            s->root_pn = attacking ? least : total;
+            s->root_dn = attacking ? total : least;
+        }
+        if (least >= th_mine || total >= th_theirs || s->stopped) {
+            break;
+        }
+        uint64_t grown = (uint64_t)second + (second / 4) + 1;
+        uint32_t child_mine = (grown < th_mine) ? (uint32_t)grown : th_mine;
+        uint64_t left = (uint64_t)th_theirs - total + theirs[best];
+        uint32_t child_theirs = (left < PN_INF) ? (uint32_t)left : PN_INF;
+        make_move(g, ms[best]);
+        mid(s, ply + 1, attacking ? child_mine : child_theirs,
+            attacking ? child_theirs : child_mine, &cpn[best], &cdn[best]);
+        unmake_move(g, ms[best]);
+    }
+    *out_pn = attacking ? least : total;
+    *out_dn = attacking ? total : least;
+    if (*out_pn == 0 || *out_dn == 0) {
+        s->proven++;
+    }
+    store(s, key, *out_pn, *out_dn, s->nodes - first);
+}
+
+/* helper function that returns the first move at the root whose number
+of the kind given (proof or disproof) is 0, or the first move if none is */
+static move solving_move(struct dfpn* s, int proof) {
+    uint32_t* numbers = proof ? s->cpn : s->cdn;
+    unsigned int n = generate_unique_moves(s->g, s->moves, 0);
+    for (unsigned int i = 0; i < n; i++) {
+        if (numbers[i] == 0) {
+            return s->moves[i];
+        }
+    }
+    return s->moves[0];
+}
+
+dfpn_result dfpn_solve(game* g, dfpn_options* opts) {
+    dfpn_result res;
+    res.value = DFPN_UNKNOWN, res.best = MOVE_NONE;
+    res.nodes = 0, res.proven = 0, res.seconds = 0;
+    if (g->state != 0) {
+        int mover = (g->next == WHITE_NEXT) ? 1 : 2;
+        res.value = (g->state == 3) ? DFPN_DRAW
+                  : (g->state == mover) ? DFPN_WIN : DFPN_LOSS;
+        return res;
+    }
+    struct dfpn s;
+    unsigned int side = g->b->side, plies = side * side + 1;
+    s.g = g;
+    s.opts = opts;
+    s.max_moves = MAX_MOVES(side);
+    size_t bucket_bytes = PN_BUCKET * sizeof(struct pn_entry);
+    size_t want = ((size_t)opts->hash_mb << 20) / bucket_bytes;
+    s.buckets = 1;
+    while (s.buckets * 2 <= want) { /* largest power of two that fits */
+        s.buckets *= 2;
+    }
+    s.table = (struct pn_entry*)calloc(s.buckets, bucket_bytes);
+    s.moves = (move*)malloc(plies * s.max_moves * sizeof(move));
+    s.cpn = (uint32_t*)malloc(plies * s.max_moves * sizeof(uint32_t));
+    s.cdn = (uint32_t*)malloc(plies * s.max_moves * sizeof(uint32_t));
+    if (s.table == NULL || s.moves == NULL || s.cpn == NULL
+        || s.cdn == NULL) {
+        fprintf(stderr, "dfpn_solve: malloc failed.\n");
+        exit(1);
+    }
+    s.used = 0, s.collections = 0;
+    s.pass = 1;
+    s.root = game_hash(g);
+    s.nodes = 0, s.proven = 0;
+    s.seconds_before = 0;
+    s.stopped = 0;
+    if (opts->checkpoint != NULL) {
+        load(&s);
+    }
+    interrupted = 0;
+    struct sigaction sa, old_int, old_term;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = interrupt;
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+    s.start = now_seconds();
+    s.first_node = s.nodes;
+    s.next_report = s.start + opts->report_s;
+    s.next_checkpoint = s.start + opts->checkpoint_s;
+    s.report_nodes = s.nodes, s.report_proven = s.proven;
+    s.report_time = s.start;
+    s.root_pn = 1, s.root_dn = 1;
+    turn mover = g->next;
+    while (!s.stopped) {
+        s.attacker = (s.pass == 1) ? mover
+                   : (mover == WHITE_NEXT) ? BLACK_NEXT : WHITE_NEXT;
+        s.salt = (s.pass == 1) ? 0 : SECOND_PASS_SALT;
+        uint32_t pn, dn;
+        mid(&s, 0, PN_INF, PN_INF, &pn, &dn);
+        if (s.stopped) {
+            break;
+        } else if (s.pass == 1 && pn == 0) {
+            res.value = DFPN_WIN;
+            res.best = solving_move(&s, 1);
+            break;
+        } else if (s.pass == 2) {
+            res.value = (pn == 0) ? DFPN_LOSS : DFPN_DRAW;
+            res.best = solving_move(&s, 0); /* every move loses */
+            break;
+        }
+        s.pass = 2; /* the mover cannot win, the first pass is spent */
+        memset(s.table, 0, s.buckets * bucket_bytes);
+        s.used = 0;
+    }
+    if (opts->report_s) {
+        report(&s, now_seconds());
+    }
+    if (opts->checkpoint != NULL) {
+        save(&s); /* solved, the next call answers at once */
+    }
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    res.nodes = s.nodes, res.proven = s.proven;
+    res.seconds = s.seconds_before + (now_seconds() - s.start);
+    free(s.cdn);
+    free(s.cpn);
+    free(s.moves);
+    free(s.table);
+    return res;
+}
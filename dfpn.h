@@ -0,0 +1,53 @@
+#ifndef _DFPN_H
+#define _DFPN_H
+
+#include "logic.h"
+
+/* game value for the player to move, as far as it was proven */
+enum dfpn_value {
+    DFPN_UNKNOWN,
+    DFPN_WIN,
+    DFPN_LOSS,
+    DFPN_DRAW
+};
+
+typedef enum dfpn_value dfpn_value;
+
+/* settings for a proof */
+struct dfpn_options {
+    unsigned int hash_mb;       /* proof table room */
+    const char* checkpoint;     /* file saved to and resumed from, or NULL */
+    unsigned int checkpoint_s;  /* seconds between checkpoints */
+    unsigned int report_s;      /* seconds between progress lines, 0 none */
+    unsigned long max_nodes;    /* gives up after this many, 0 for never */
+};
+
+typedef struct dfpn_options dfpn_options;
+
+struct dfpn_result {
+    dfpn_value value;
+    move best;              /* a move keeping the value, any on a loss,
+                            MOVE_NONE if there is none */
+    unsigned long nodes;    /* positions expanded, over every session */
+    unsigned long proven;   /* of those, ones proven or disproven */
+    double seconds;         /* time spent, over every session */
+};
+
+typedef struct dfpn_result dfpn_result;
+
+/* proves the value of g for the player to move with depth-first proof
+number search over make_move, first whether the mover wins and, if not,
+whether the opponent does. positions are looked up in a proof table of
+bounded size, early ones by their hash over the symmetry group. when it is
+nearly full the entries with the smallest subtrees are dropped, unsolved
+ones first. new leaves whose mover can win by a placement alone are solved
+on the spot. with a checkpoint file the table is written there every
+checkpoint_s seconds and when the search is interrupted (SIGINT or
+SIGTERM) or runs out of nodes, and a later call on the same position
+carries on from it. every report_s seconds a line gives the nodes expanded
+and proven per second and the proof and disproof numbers of the root. best
+is MOVE_NONE unless the value was found and g was not over already. g is
+searched in place and left as it was */
+dfpn_result dfpn_solve(game* g, dfpn_options* opts);
+
+#endif /* _DFPN_H */
@@ -0,0 +1,306 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "eval.h"
+
+/* most marbles a line's weight grows with, 4^k after that stays flat */
+#define EVAL_MAX_WEIGHT 10
+
+/* bonus by how many threats (lines one marble short, straight or after a
+twist) a colour has, capped at 3. the mover's first threat wins on the
+spot; the opponent's can be blocked one at a time */
+static const int mover_threats[4] = {0, 1 << 23, 1 << 23, 1 << 23};
+static const int opponent_threats[4] = {0, 1 << 16, 1 << 21, 1 << 22};
+
+
+/* cells that become a winning line after one twist, for one board side.
+built once per side and shared, like the lines themselves */
+struct eval_table {
+    unsigned int side;
+    unsigned int len;      /* cells per line, side - 1 */
+    unsigned int count;    /* twist lines not already plain lines */
+    unsigned int* cells;   /* len sorted cell numbers per twist line */
+    unsigned int* first;   /* through[first[c]] onwards: lines of cell c */
+    unsigned int* through; /* twist line numbers, grouped by cell */
+    int* line_score;       /* plain line worth to white by its counts */
+    struct eval_table* next;
+};
+
+struct evaluator {
+    const struct eval_table* t;
+    unsigned char* counts;       /* per twist line: BLACK at 2i, WHITE 2i+1 */
+    int lines;                   /* plain line scores, white minus black */
+    unsigned int threats[2];     /* plain lines one short: BLACK, WHITE */
+    unsigned int twists[2];      /* twist lines one short */
+    nnue_acc* nn;                /* the network's accumulator, or NULL */
+};
+
+static struct eval_table* tables = NULL;
+static const nnue* network = NULL;
+static pthread_mutex_t tables_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* helper function that returns where cell lands when quadrant q of a board
+of inputted side is twisted, clockwise if cw is nonzero */
+static unsigned int twist_cell(unsigned int side, unsigned int cell,
+quadrant q, int cw) {
+    unsigned int n = side / 2, r = cell / side, c = cell % side;
+    unsigned int ro = (q == SW || q == SE) ? n : 0;
+    unsigned int co = (q == NE || q == SE) ? n : 0;
+    if (r < ro || r >= ro + n || c < co || c >= co + n) {
+        return cell; /* outside the quadrant, stays put */
+    }
+    unsigned int a = r - ro, b = c - co;
+    return cw ? ((ro + b) * side) + co + n - 1 - a
+              : ((ro + n - 1 - b) * side) + co + a;
+}
+
+/* helper function for qsort that orders cell numbers */
+static int compare_cells(const void* a, const void* b) {
+    unsigned int x = *(const unsigned int*)a, y = *(const unsigned int*)b;
+    return (x > y) - (x < y);
+}
+
+/* helper function that returns 1 if the len cells at set already appear
+among the first n sets of table cells, or among the plain lines. sorted
+is scratch room for len cells */
+static int seen(const lines* l, const unsigned int* cells, unsigned int n,
+const unsigned int* set, unsigned int* sorted) {
+    unsigned int i, len = l->len;
+    for (i = 0; i < n; i++) {
+        if (memcmp(&cells[i * len], set, len * sizeof(unsigned int)) == 0) {
+            return 1;
+        }
+    }
+    for (i = 0; i < l->count; i++) { /* plain lines are stored unsorted */
+        memcpy(sorted, &l->cells[i * len], len * sizeof(unsigned int));
+        qsort(sorted, len, sizeof(unsigned int), compare_cells);
+        if (memcmp(sorted, set, len * sizeof(unsigned int)) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* helper function that builds the table for one side: the preimage of
+every line under every twist (the image under the opposite twist), less
+repeats and plain lines, then the twist lines through each cell */
+static void build(struct eval_table* t, unsigned int side) {
+    const lines* l = lines_get(side);
+    unsigned int len = l->len, cells = side * side, i, k, j, n = 0;
+    unsigned int* set = (unsigned int*)malloc(2 * len * sizeof(unsigned int));
+    t->side = side;
+    t->len = len;
+    t->cells = (unsigned int*)malloc(l->count * 8 * len
+                                     * sizeof(unsigned int));
+    t->first = (unsigned int*)calloc(cells + 1, sizeof(unsigned int));
+    t->line_score = (int*)malloc((len + 1) * (len + 1) * sizeof(int));
+    if (set == NULL || t->cells == NULL || t->first == NULL
+        || t->line_score == NULL) {
+        fprintf(stderr, "eval_attach: malloc failed.\n");
+        exit(1);
+    }
+    for (i = 0; i < l->count; i++) {
+        for (k = 0; k < 8; k++) { /* twist k is quadrant k / 2 */
+            for (j = 0; j < len; j++) {
+                set[j] = twist_cell(side, l->cells[(i * len) + j],
+                                    (quadrant)(k >> 1), (k & 1) == CW);
+            }
+            qsort(set, len, sizeof(unsigned int), compare_cells);
+            if (!seen(l, t->cells, n, set, set + len)) {
+                memcpy(&t->cells[n++ * len], set, len * sizeof(unsigned int));
+            }
+        }
+    }
+    t->count = n;
+    free(set);
+    for (i = 0; i < n * len; i++) { /* cell c's lines start at first[c] */
+        t->first[t->cells[i] + 1]++;
+    }
+    for (i = 0; i < cells; i++) {
+        t->first[i + 1] += t->first[i];
+    }
+    t->through = (unsigned int*)malloc((n * len + 1) * sizeof(unsigned int));
+    unsigned int* at = (unsigned int*)malloc(cells * sizeof(unsigned int));
+    if (t->through == NULL || at == NULL) {
+        fprintf(stderr, "eval_attach: malloc failed.\n");
+        exit(1);
+    }
+    memcpy(at, t->first, cells * sizeof(unsigned int));
+    for (i = 0; i < n * len; i++) {
+        t->through[at[t->cells[i]]++] = i / len;
+    }
+    free(at);
+    for (i = 0; i <= len; i++) { /* i black and j white marbles */
+        for (j = 0; j <= len; j++) {
+            unsigned int kb = (i > EVAL_MAX_WEIGHT) ? EVAL_MAX_WEIGHT : i;
+            unsigned int kw = (j > EVAL_MAX_WEIGHT) ? EVAL_MAX_WEIGHT : j;
+            int score = 0;
+            if (i && !j) {
+                score = -(1 << (2 * kb));
+            } else if (j && !i) {
+                score = 1 << (2 * kw);
+            }
+            t->line_score[(i * (len + 1)) + j] = score;
+        }
+    }
+}
+
+/* helper function that returns the table for side, building it the first
+time. like lines_get it may be called from several threads at once */
+static const struct eval_table* table_get(unsigned int side) {
+    struct eval_table* t;
+    pthread_mutex_lock(&tables_lock);
+    for (t = tables; t != NULL && t->side != side; t = t->next) {
+    }
+    if (t == NULL) {
+        t = (struct eval_table*)malloc(sizeof(struct eval_table));
+        if (t == NULL) {
+            fprintf(stderr, "eval_attach: malloc failed.\n");
+            exit(1);
+        }
+        build(t, side);
+        t->next = tables;
+        tables = t;
+    }
+    pthread_mutex_unlock(&tables_lock);
+    return t;
+}
+
+/* helper function that returns 1 if a line with own and other marbles of
+two colours on it is one marble short of a win for own */
+static int threat(unsigned int own, unsigned int other, unsigned int len) {
+    return own + 1 == len && other == 0;
+}
+
+void eval_attach(game* g) {
+    evaluator* ev = (evaluator*)malloc(sizeof(evaluator));
+    if (ev == NULL) {
+        fprintf(stderr, "eval_attach: malloc failed.\n");
+        exit(1);
+    }
+    ev->t = table_get(g->b->side);
+    ev->nn = (network != NULL && nnue_side(network) == g->b->side)
+           ? nnue_acc_new(network) : NULL;
+    ev->counts = (unsigned char*)malloc(2 * ev->t->count + 1);
+    if (ev->counts == NULL) {
+        fprintf(stderr, "eval_attach: malloc failed.\n");
+        exit(1);
+    }
+    g->ev = ev;
+    eval_refresh(g);
+}
+
+void eval_detach(game* g) {
+    if (g->ev != NULL) {
+        if (g->ev->nn != NULL) {
+            nnue_acc_free(g->ev->nn);
+        }
+        free(g->ev->counts);
+        free(g->ev);
+        g->ev = NULL;
+    }
+}
+
+void eval_refresh(game* g) {
+    evaluator* ev = g->ev;
+    const struct eval_table* t = ev->t;
+    const lines* l = g->lines;
+    unsigned int i, len = l->len, cells = t->side * t->side;
+    if (ev->nn != NULL) { /* the network replaces the line scores */
+        nnue_acc_refresh(ev->nn, g->b);
+        return;
+    }
+    ev->lines = 0;
+    ev->threats[0] = 0, ev->threats[1] = 0;
+    ev->twists[0] = 0, ev->twists[1] = 0;
+    for (i = 0; i < l->count; i++) {
+        unsigned int b = g->counts[2 * i], w = g->counts[(2 * i) + 1];
+        ev->lines += t->line_score[(b * (len + 1)) + w];
+        ev->threats[0] += threat(b, w, len);
+        ev->threats[1] += threat(w, b, len);
+    }
+    memset(ev->counts, 0, 2 * t->count);
+    for (i = 0; i < cells; i++) {
+        square s = board_get(g->b, make_pos(i / t->side, i % t->side));
+        if (s == EMPTY) {
+            continue;
+        }
+        for (unsigned int k = t->first[i]; k < t->first[i + 1]; k++) {
+            ev->counts[(2 * t->through[k]) + s - 1]++;
+        }
+    }
+    for (i = 0; i < t->count; i++) {
+        unsigned int b = ev->counts[2 * i], w = ev->counts[(2 * i) + 1];
+        ev->twists[0] += threat(b, w, len);
+        ev->twists[1] += threat(w, b, len);
+    }
+}
+
+void eval_copy(game* dst, const game* src) {
+    evaluator* d = dst->ev;
+    const evaluator* s = src->ev;
+    if ((d->nn == NULL) != (s->nn == NULL)) {
+        /* one keeps line scores the other never updated: start afresh */
+        eval_refresh(dst);
+        return;
+    }
+    unsigned char* counts = d->counts;
+    nnue_acc* nn = d->nn;
+    memcpy(counts, s->counts, 2 * s->t->count);
+    *d = *s;
+    d->counts = counts, d->nn = nn;
+    if (nn != NULL) {
+        nnue_acc_copy(nn, s->nn);
+    }
+}
+
+void eval_update(game* g, unsigned int cell, square old, square new) {
+    evaluator* ev = g->ev;
+    const struct eval_table* t = ev->t;
+    const lines* l = g->lines;
+    const unsigned int* through = &l->cell_lines[cell * LINES_PER_CELL];
+    unsigned int len = l->len, i;
+    if (ev->nn != NULL) {
+        nnue_acc_update(ev->nn, cell, old, new);
+        return;
+    }
+    /* what each count was before: the cell added new and took away old */
+    int db = (new == BLACK) - (old == BLACK);
+    int dw = (new == WHITE) - (old == WHITE);
+    for (i = 0; i < l->per_cell[cell]; i++) {
+        unsigned int b = g->counts[2 * through[i]];
+        unsigned int w = g->counts[(2 * through[i]) + 1];
+        unsigned int ob = b - db, ow = w - dw;
+        ev->lines += t->line_score[(b * (len + 1)) + w]
+                   - t->line_score[(ob * (len + 1)) + ow];
+        ev->threats[0] += threat(b, w, len) - threat(ob, ow, len);
+        ev->threats[1] += threat(w, b, len) - threat(ow, ob, len);
+    }
+    for (i = t->first[cell]; i < t->first[cell + 1]; i++) {
+        unsigned char* n = &ev->counts[2 * t->through[i]];
+        unsigned int ob = n[0], ow = n[1];
+        n[0] += db, n[1] += dw;
+        ev->twists[0] += threat(n[0], n[1], len) - threat(ob, ow, len);
+        ev->twists[1] += threat(n[1], n[0], len) - threat(ow, ob, len);
+    }
+}
+
+void eval_use_network(const nnue* net) {
+    network = net;
+}
+
+int eval_score(game* g) {
+    const evaluator* ev = g->ev;
+    if (ev->nn != NULL) {
+        return nnue_score(ev->nn, g->next);
+    }
+    unsigned int me = (g->next == WHITE_NEXT), i;
+    unsigned int mine = ev->threats[me] + ev->twists[me];
+    unsigned int theirs = ev->threats[!me] + ev->twists[!me];
+    i = (mine < 3) ? mine : 3;
+    int score = me ? ev->lines : -ev->lines;
+    score += mover_threats[i];
+    i = (theirs < 3) ? theirs : 3;
+    return score - opponent_threats[i];
+}
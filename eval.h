@@ -0,0 +1,45 @@
+#ifndef _EVAL_H
+#define _EVAL_H
+
+#include "logic.h"
+#include "nnue.h"
+
+struct evaluator;
+
+typedef struct evaluator evaluator;
+
+/* gives g an evaluator, scored from its current board. from then on every
+cell that changes through place_marble, twist_quadrant or unmake_move
+updates the score in time proportional to the lines through that cell */
+void eval_attach(game* g);
+
+/* frees the evaluator of g, if it has one */
+void eval_detach(game* g);
+
+/* returns the static score of g for the player to move, which must have an
+evaluator: the network's score if it has one, otherwise lines held by one
+colour only, weighted by their marbles, plus bonuses for lines one marble
+short of a win. those include "twist lines", cells that become a line
+after one quadrant twist, since a placement and that twist win together.
+several such threats at once count for more */
+int eval_score(game* g);
+
+/* makes evaluators attached from now on score with net instead of the
+line scores above, on games of the side net was made for (others keep
+the line scores). NULL goes back to the line scores. the network must
+outlive every evaluator using it */
+void eval_use_network(const nnue* net);
+
+/* updates the evaluator of g after cell went from old to new. called by
+logic.c once g's line counts have been updated */
+void eval_update(game* g, unsigned int cell, square old, square new);
+
+/* rescores the evaluator of g from its board */
+void eval_refresh(game* g);
+
+/* overwrites the evaluator of dst with that of src, both games having
+evaluators and the same side, once dst's board has been set to src's. if
+only one of them scores with a network, dst is rescored from its board */
+void eval_copy(game* dst, const game* src);
+
+#endif /* _EVAL_H */
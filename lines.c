@@ -0,0 +1,87 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "lines.h"
+
+/* every table built so far, one per side */
+struct lines_node {
+    lines l;
+    struct lines_node* next;
+};
+
+static struct lines_node* built = NULL;
+static pthread_mutex_t built_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* helper function that adds the line of len cells starting at (r, c) and
+stepping (dr, dc) between cells to table l as line number i */
+static void add_line(lines* l, unsigned int i, unsigned int r, unsigned int c,
+int dr, int dc) {
+    for (unsigned int k = 0; k < l->len; k++) {
+        unsigned int cell = (r + k * dr) * l->side + (c + k * dc);
+        l->cells[i * l->len + k] = cell;
+        l->cell_lines[cell * LINES_PER_CELL + l->per_cell[cell]] = i;
+        l->per_cell[cell]++;
+        if (l->masks != NULL) {
+            l->masks[i] |= (uint64_t)1 << cell;
+        }
+    }
+}
+
+/* helper function that builds the table for one side, lines are numbered in
+the order horizontal, vertical, right diagonal, left diagonal */
+static void build(lines* l, unsigned int side) {
+    unsigned int cells = side * side, i = 0, r, c;
+    l->side = side;
+    l->len = side - 1;
+    l->count = (4 * side) + 8;
+    l->cells = (unsigned int*)malloc(l->count * l->len * sizeof(unsigned int));
+    l->per_cell = (unsigned char*)calloc(cells, sizeof(unsigned char));
+    l->cell_lines = (unsigned int*)malloc(cells * LINES_PER_CELL
+                                          * sizeof(unsigned int));
+    l->masks = (side <= 8) ? (uint64_t*)calloc(l->count, sizeof(uint64_t))
+                           : NULL;
+    if (l->cells == NULL || l->per_cell == NULL || l->cell_lines == NULL
+        || (side <= 8 && l->masks == NULL)) {
+        fprintf(stderr, "lines_get: malloc failed.\n");
+        exit(1);
+    }
+    for (r = 0; r < side; r++) { /* two horizontal lines per row */
+        for (c = 0; c <= 1; c++) {
+            add_line(l, i++, r, c, 0, 1);
+        }
+    }
+    for (c = 0; c < side; c++) { /* two vertical lines per column */
+        for (r = 0; r <= 1; r++) {
+            add_line(l, i++, r, c, 1, 0);
+        }
+    }
+    for (r = 0; r <= 1; r++) { /* right diagonals from the top-left corner */
+        for (c = 0; c <= 1; c++) {
+            add_line(l, i++, r, c, 1, 1);
+        }
+    }
+    for (r = 0; r <= 1; r++) { /* left diagonals from the top-right corner */
+        for (c = side - 2; c <= side - 1; c++) {
+            add_line(l, i++, r, c, 1, -1);
+        }
+    }
+}
+
+const lines* lines_get(unsigned int side) {
+    struct lines_node* n;
+    pthread_mutex_lock(&built_lock);
+    for (n = built; n != NULL && n->l.side != side; n = n->next) {
+    }
+    if (n == NULL) {
+        n = (struct lines_node*)malloc(sizeof(struct lines_node));
+        if (n == NULL) {
+            fprintf(stderr, "lines_get: malloc failed.\n");
+            exit(1);
+        }
+        build(&n->l, side);
+        n->next = built;
+        built = n;
+    }
+    pthread_mutex_unlock(&built_lock);
+    return &n->l;
+}
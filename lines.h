@@ -0,0 +1,27 @@
+#ifndef _LINES_H
+#define _LINES_H
+
+#include <stdint.h>
+
+/* most lines a single cell can lie on: two per direction */
+#define LINES_PER_CELL 8
+
+
+struct lines {
+    unsigned int side;        /* board side the table was built for */
+    unsigned int len;         /* cells per line, side - 1 */
+    unsigned int count;       /* number of lines, 4 * side + 8 */
+    unsigned int* cells;      /* len cell numbers (r * side + c) per line */
+    unsigned char* per_cell;  /* number of lines through each cell */
+    unsigned int* cell_lines; /* LINES_PER_CELL line numbers for each cell */
+    uint64_t* masks;          /* one bit mask per line, NULL if side > 8 */
+};
+
+typedef struct lines lines;
+
+/* returns the table of winning lines for boards of inputted side, building it
+the first time a side is asked for. it may be called from several threads at
+once. tables live until the program exits */
+const lines* lines_get(unsigned int side);
+
+#endif /* _LINES_H */
@@ -1,24 +1,197 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "eval.h"
 #include "logic.h"
 
+/* helper function that sets up an empty game on board b, whose line
+counts live at counts */
+static void game_init(game* g, board* b, unsigned char* counts) {
+    g->b = b;
+    g->next = WHITE_NEXT; /* WHITE goes first */
+    g->lines = lines_get(b->side);
+    g->counts = counts;
+    memset(counts, 0, 2 * g->lines->count);
+    g->wins[0] = 0, g->wins[1] = 0;
+    g->filled = 0;
+    g->state = 0;
+    g->skipped = 0;
+    g->ev = NULL;
+    memset(g->asym90, 0, sizeof(g->asym90));
+    memset(g->asym180, 0, sizeof(g->asym180));
+}
+
 game* new_game(unsigned int side, enum type type) {
     game* g = (game*)malloc(sizeof(game));
     if (g == NULL) {
         fprintf(stderr, "new_game: malloc failed.\n");
         exit(1);
-    } else {
-        g->b = board_new(side, type);
-        g->next = WHITE_NEXT; /* WHITE goes first */
-        return g;
     }
+    board* b = board_new(side, type);
+    unsigned char* counts = (unsigned char*)malloc(2 * lines_get(side)->count);
+    if (counts == NULL) {
+        fprintf(stderr, "new_game: malloc failed.\n");
+        exit(1);
+    }
+    game_init(g, b, counts);
+    return g;
 }
 
 void game_free(game* g) {
+    eval_detach(g);
     board_free(g->b);
+    free(g->counts);
     free(g);
 }
 
+/* helper function that moves a cell from colour old to colour new in the
+counts of every line through it, keeping the complete line totals in step */
+void recount_cell(game* g, unsigned int cell, square old, square new) {
+    const lines* l = g->lines;
+    const unsigned int* through = &l->cell_lines[cell * LINES_PER_CELL];
+    for (unsigned int i = 0; i < l->per_cell[cell]; i++) {
+        unsigned char* n = &g->counts[2 * through[i]];
+        if (old != EMPTY && n[old - 1]-- == l->len) {
+            g->wins[old - 1]--; /* line is no longer complete */
+        }
+        if (new != EMPTY && ++n[new - 1] == l->len) {
+            g->wins[new - 1]++; /* line has just been completed */
+        }
+    }
+    g->filled += (new != EMPTY) - (old != EMPTY);
+    if (g->ev != NULL) {
+        eval_update(g, cell, old, new);
+    }
+}
+
+/* helper function that returns the quadrant holding p on a board whose
+quadrants have side n */
+static unsigned int quadrant_of(pos p, unsigned int n) {
+    return ((p.r >= n) ? 2 : 0) + ((p.c >= n) ? 1 : 0);
+}
+
+/* helper function that looks at the cells p goes through when its quadrant
+turns, and stores how changing p from old to new changes the symmetry
+counts of the quadrant: whether those four cells are all alike in d90, and
+whether p matches its 180 degree image in d180 */
+static void orbit_change(game* g, pos p, square old, square new, int* d90,
+int* d180) {
+    unsigned int n = g->b->side / 2;
+    unsigned int r0 = (p.r >= n) ? n : 0, c0 = (p.c >= n) ? n : 0;
+    unsigned int i = p.r - r0, j = p.c - c0;
+    if (2 * i == n - 1 && 2 * j == n - 1) {
+        *d90 = 0, *d180 = 0; /* the centre of an odd quadrant stays put */
+        return;
+    }
+    square cw = board_get(g->b, make_pos(r0 + j, c0 + n - 1 - i));
+    square half = board_get(g->b, make_pos(r0 + n - 1 - i, c0 + n - 1 - j));
+    square ccw = board_get(g->b, make_pos(r0 + n - 1 - j, c0 + i));
+    int rest = (cw != half || ccw != half); /* the other three differ */
+    *d90 = (rest || half != new) - (rest || half != old);
+    *d180 = (half != new) - (half != old);
+}
+
+/* helper function that changes one cell of the board, updating line counts
+and the symmetry counts of its quadrant. twists only permute the cells of
+each orbit, so only changes made here can alter those counts */
+void set_cell(game* g, pos p, square s) {
+    square old = board_get(g->b, p);
+    if (old != s) {
+        unsigned int q = quadrant_of(p, g->b->side / 2);
+        int d90, d180;
+        orbit_change(g, p, old, s, &d90, &d180);
+        g->asym90[q] += d90;
+        g->asym180[q] += d180;
+        board_set(g->b, p, s);
+        recount_cell(g, (p.r * g->b->side) + p.c, old, s);
+    }
+}
+
+/* helper function that returns condition of a game from the line totals:
+whether a game is finished or not. If yes, returns who wins/draw */
+int compute_state(game* g) {
+    unsigned int w = g->wins[1], b = g->wins[0];
+    int full = (g->filled == g->b->side * g->b->side);
+    if (w != 0 && b == 0) {
+        return 1; /* 1 = white wins */
+    } else if (w == 0 && b != 0) {
+        return 2; /* 2 = black wins */
+    } else if (((w==0 && b==0) && full)|| (w!=0 && b!=0)) {
+        return 3; /* 3 = draw, board is full + no win or multiple win */
+    } else {
+        return 0; /* 0 = game is not over */
+    }
+}
+
+void game_reset(game* g) {
+    board_clear(g->b);
+    memset(g->counts, 0, 2 * g->lines->count);
+    g->next = WHITE_NEXT; /* WHITE goes first */
+    g->wins[0] = 0, g->wins[1] = 0;
+    g->filled = 0;
+    g->state = 0;
+    g->skipped = 0;
+    memset(g->asym90, 0, sizeof(g->asym90));
+    memset(g->asym180, 0, sizeof(g->asym180));
+    if (g->ev != NULL) {
+        eval_refresh(g);
+    }
+}
+
+void game_load(game* dst, game* src) {
+    unsigned int side = src->b->side;
+    if (dst->b->side != side) {
+        fprintf(stderr, "game_load: games must have the same side.\n");
+        exit(1);
+    }
+    game_reset(dst);
+    for (unsigned int r = 0; r < side; r++) {
+        for (unsigned int c = 0; c < side; c++) {
+            pos p = make_pos(r, c);
+            set_cell(dst, p, board_get(src->b, p));
+        }
+    }
+    dst->next = src->next;
+    dst->state = compute_state(dst);
+    dst->skipped = src->skipped;
+}
+
+game* game_clone(game* g) {
+    game* new = (game*)malloc(sizeof(game));
+    if (new == NULL) {
+        fprintf(stderr, "game_clone: malloc failed.\n");
+        exit(1);
+    }
+    *new = *g;
+    new->b = board_clone(g->b);
+    new->counts = (unsigned char*)malloc(2 * g->lines->count);
+    if (new->counts == NULL) {
+        fprintf(stderr, "game_clone: malloc failed.\n");
+        exit(1);
+    }
+    memcpy(new->counts, g->counts, 2 * g->lines->count);
+    new->ev = NULL;
+    if (g->ev != NULL) {
+        eval_attach(new);
+    }
+    return new;
+}
+
+void game_copy(game* dst, game* src) {
+    board* b = dst->b;
+    unsigned char* counts = dst->counts;
+    struct evaluator* ev = dst->ev;
+    board_copy(b, src->b);
+    memcpy(counts, src->counts, 2 * src->lines->count);
+    *dst = *src;
+    dst->b = b, dst->counts = counts, dst->ev = ev; /* keep dst's storage */
+    if (ev != NULL && src->ev != NULL) {
+        eval_copy(dst, src);
+    } else if (ev != NULL) {
+        eval_refresh(dst);
+    }
+}
+
 int place_marble(game* g, pos p) {
     if ((p.r >= g->b->side) || (p.c >= g->b->side)) {
         fprintf(stderr, "place_marble: position out of bounds.\n");
@@ -26,37 +199,122 @@ int place_marble(game* g, pos p) {
     } else if (board_get(g->b, p) != EMPTY) {
         return 0; /* if occupied, do nothing and return false */
     } else if (g->next == WHITE_NEXT) { /* if white's turn */
-        board_set(g->b, p, WHITE);
+        set_cell(g, p, WHITE);
+        g->state = compute_state(g);
         return 1;
     } else { /* if black's turn */
-        board_set(g->b, p, BLACK);
+        set_cell(g, p, BLACK);
+        g->state = compute_state(g);
         return 1;
     }
 }
 
-/* helper fn: allocate space for a square quadrant matrix of a given size */
-square** quadrant_new(unsigned int side) {
-    square** new = (square**)malloc(side * sizeof(square*));
-    if (new == NULL) {
-        fprintf(stderr, "quadrant_new: malloc failed.\n");
-        exit(1);
-    }
-    for (unsigned int i = 0; i < side; i++) {
-        new[i] = (square*)malloc(side * sizeof(square));
-        if (new[i] == NULL) {
-            fprintf(stderr, "quadrant_new: malloc failed.\n");
-            exit(1);
+/* helper function that sets the count of colour k (0 BLACK, 1 WHITE) on
+line i to n, keeping the complete line totals in step */
+static void set_count(game* g, unsigned int i, unsigned int k,
+unsigned int n) {
+    unsigned char* count = &g->counts[(2 * i) + k];
+    unsigned int len = g->lines->len;
+    g->wins[k] += (n == len) - (*count == len);
+    *count = (unsigned char)n;
+}
+
+/* helper function that recounts, cell by cell, the cells of a LARGE board
+that changed colour when the quadrant starting at row r_offset turned.
+before holds its rows from before the twist, BLACK's then WHITE's */
+static void recount_changed(game* g, unsigned int r_offset,
+const uint64_t* before) {
+    unsigned int side = g->b->side, n = side / 2;
+    for (unsigned int i = 0; i < n; i++) {
+        uint64_t ob = before[i], ow = before[n + i];
+        uint64_t nb = g->b->u.rows[r_offset + i];
+        uint64_t nw = g->b->u.rows[side + r_offset + i];
+        uint64_t changed = (ob ^ nb) | (ow ^ nw);
+        while (changed) {
+            unsigned int c = __builtin_ctzll(changed);
+            square old = ((ob >> c) & 1) ? BLACK
+                       : ((ow >> c) & 1) ? WHITE : EMPTY;
+            square new = ((nb >> c) & 1) ? BLACK
+                       : ((nw >> c) & 1) ? WHITE : EMPTY;
+            recount_cell(g, ((r_offset + i) * side) + c, old, new);
+            changed &= changed - 1;
         }
     }
-    return new;
 }
 
-/* helper function for freeing a square quadrant matrix */
-void quadrant_free(square** q, unsigned int len) {
-    for (unsigned int i = 0; i < len; i++) {
-        free(q[i]);
+/* helper function that brings the line counts of a LARGE board up to date
+after the quadrant at (r_offset, c_offset) turned in direction d, a word
+at a time instead of cell by cell. before is as for recount_changed.
+lines are numbered as in lines.c: two horizontal per row, two vertical per
+column, then the diagonals.
+horizontal lines through the quadrant are recounted with one popcount.
+a twist turns the quadrant's rows into its columns, so each vertical line
+changes by the difference of two row popcounts, less the one cell of the
+quadrant it leaves out. only the few changed cells that lie on a diagonal
+are recounted one at a time */
+static void recount_rows(game* g, unsigned int r_offset, unsigned int c_offset,
+direction d, const uint64_t* before) {
+    const lines* l = g->lines;
+    unsigned int side = g->b->side, n = side / 2, i, j, k;
+    uint64_t quad = (((uint64_t)1 << n) - 1) << c_offset;
+    uint64_t full = ((uint64_t)1 << l->len) - 1; /* horizontal windows */
+    uint64_t window[2] = {full, full << 1};
+    /* the quadrant row that one of the two vertical lines leaves out */
+    unsigned int edge = (r_offset == 0) ? 0 : n - 1;
+    unsigned int partial = (r_offset == 0) ? 1 : 0;
+    for (k = 0; k <= 1; k++) { /* BLACK, then WHITE */
+        const uint64_t* rows = &g->b->u.rows[(k * side) + r_offset];
+        const uint64_t* old = &before[k * n];
+        unsigned int was[BOARD_LARGE_SIDE / 2], now[BOARD_LARGE_SIDE / 2];
+        for (i = 0; i < n; i++) {
+            unsigned int line = 2 * (r_offset + i);
+            was[i] = __builtin_popcountll(old[i] & quad);
+            now[i] = __builtin_popcountll(rows[i] & quad);
+            set_count(g, line, k, __builtin_popcountll(rows[i] & window[0]));
+            set_count(g, line + 1, k,
+                      __builtin_popcountll(rows[i] & window[1]));
+        }
+        for (j = 0; j < n; j++) {
+            unsigned int c = c_offset + j, line = (2 * side) + (2 * c);
+            /* clockwise, column j after is row n-1-j before and column j
+            before is row j after; counter-clockwise the other way round */
+            int delta = (d == CW) ? (int)was[n - 1 - j] - (int)now[j]
+                                  : (int)was[j] - (int)now[n - 1 - j];
+            int e = (int)((rows[edge] >> c) & 1) - (int)((old[edge] >> c) & 1);
+            for (unsigned int s = 0; s <= 1; s++) {
+                unsigned int count = g->counts[(2 * (line + s)) + k];
+                set_count(g, line + s, k,
+                          count + delta - ((s == partial) ? e : 0));
+            }
+        }
+        for (i = 0; i < n; i++) {
+            unsigned int r = r_offset + i, t;
+            uint64_t diagonal = 0; /* columns a diagonal can cross row r */
+            int cols[6] = {(int)r - 1, (int)r, (int)r + 1,
+                           (int)(side - 2 - r), (int)(side - 1 - r),
+                           (int)(side - r)};
+            for (t = 0; t < 6; t++) {
+                if (cols[t] >= 0 && cols[t] < (int)side) {
+                    diagonal |= (uint64_t)1 << cols[t];
+                }
+            }
+            uint64_t changed = (old[i] ^ rows[i]) & diagonal;
+            while (changed) {
+                unsigned int c = __builtin_ctzll(changed);
+                unsigned int cell = (r * side) + c;
+                const unsigned int* through =
+                    &l->cell_lines[cell * LINES_PER_CELL];
+                int step = ((rows[i] >> c) & 1) ? 1 : -1;
+                for (t = 0; t < l->per_cell[cell]; t++) {
+                    if (through[t] >= 4 * side) { /* a diagonal */
+                        set_count(g, through[t], k,
+                                  g->counts[(2 * through[t]) + k] + step);
+                    }
+                }
+                changed &= changed - 1;
+            }
+        }
     }
-    free(q);
 }
 
 /* helper function used to find offset values depending on the quadrant
@@ -80,152 +338,455 @@ unsigned int quad_len) {
 }
 
 void twist_quadrant(game* g, quadrant q, direction d) {
-    unsigned int quad_len = g->b->side / 2;
-    /* new quadrant matrix used for extracting, twisting, and inserting */
-    square** q_new = quadrant_new(quad_len);
-    /* declaring matrix indicies & offset values for extraction & insertion */
-    unsigned int a = 0, b, r = 0, c = 0, r_offset, c_offset;
+    unsigned int quad_len = g->b->side / 2, r_offset, c_offset, i, j;
     find_offsets(&r_offset, &c_offset, q, quad_len);
-    /* extracting quadrant to be twisted */
-    for (r = r_offset; r < r_offset + quad_len; r++) { /* iterating row */
-        b = 0;
-        for (c = c_offset; c < c_offset + quad_len; c++) { /* iterating col */
-            q_new[a][b] = board_get(g->b, make_pos(r, c));
-            b++;
-        }
-        a++;
-    }
-    /* inserting twisted quadrant using derived formulas*/
-    if (d == CCW) { /* inserting for counter-clockwise */
-        for (r = r_offset; r < r_offset + quad_len; r++) { /* iterating row */
-            for (c = c_offset; c < c_offset + quad_len; c++) { /* column */
-                //g->b->u.cells[r][c] = q_new[c-c_offset][quad_len+r_offset-1-r];
-                square new_sq = q_new[c-c_offset][quad_len+r_offset-1-r];
-                board_set(g->b, make_pos(r, c), new_sq);
-            }
+    if (g->b->type == MASKS) { /* rotate whole words */
+        uint64_t black = g->b->u.masks[0], white = g->b->u.masks[1];
+        board_rotate(g->b, make_pos(r_offset, c_offset), d == CW);
+        /* only cells whose colour changed touch the line counts */
+        uint64_t changed = (black ^ g->b->u.masks[0])
+                         | (white ^ g->b->u.masks[1]);
+        while (changed) {
+            unsigned int cell = __builtin_ctzll(changed);
+            square old = ((black >> cell) & 1) ? BLACK
+                       : ((white >> cell) & 1) ? WHITE : EMPTY;
+            square new = ((g->b->u.masks[0] >> cell) & 1) ? BLACK
+                       : ((g->b->u.masks[1] >> cell) & 1) ? WHITE : EMPTY;
+            recount_cell(g, cell, old, new);
+            changed &= changed - 1;
+        }
+    } else if (g->b->type == LARGE) { /* rotate rows a word at a time */
+        unsigned int side = g->b->side;
+        uint64_t before[BOARD_LARGE_SIDE]; /* the quadrant's rows, BLACK's
+                                              then WHITE's */
+        memcpy(before, &g->b->u.rows[r_offset], quad_len * sizeof(uint64_t));
+        memcpy(before + quad_len, &g->b->u.rows[side + r_offset],
+               quad_len * sizeof(uint64_t));
+        board_rotate(g->b, make_pos(r_offset, c_offset), d == CW);
+        if (g->ev == NULL) {
+            recount_rows(g, r_offset, c_offset, d, before);
+        } else { /* the evaluator follows single cells */
+            recount_changed(g, r_offset, before);
         }
-    } else { /* inserting for clockwise */
-        for (r = r_offset; r < r_offset + quad_len; r++) { /* iterating row */
-            for (c = c_offset; c < c_offset + quad_len; c++) { /* column */
-                //g->b->u.cells[r][c] = q_new[quad_len+c_offset-1-c][r-r_offset];
-                square new_sq = q_new[quad_len+c_offset-1-c][r-r_offset];
-                board_set(g->b, make_pos(r, c), new_sq);
+    } else { /* rotated in place by the board, no scratch matrix */
+        board_rotate(g->b, make_pos(r_offset, c_offset), d == CW);
+        for (i = 0; i < quad_len; i++) {
+            for (j = 0; j < quad_len; j++) {
+                /* what (i, j) held before the twist has moved to (j, n-1-i)
+                for clockwise and to (n-1-j, i) for counter-clockwise */
+                pos p = make_pos(r_offset + i, c_offset + j);
+                pos from = (d == CW)
+                    ? make_pos(r_offset + j, c_offset + quad_len - 1 - i)
+                    : make_pos(r_offset + quad_len - 1 - j, c_offset + i);
+                square old = board_get(g->b, from), new = board_get(g->b, p);
+                if (old != new) {
+                    recount_cell(g, (p.r * g->b->side) + p.c, old, new);
+                }
             }
         }
     }
     g->next = (g->next == WHITE_NEXT) ? BLACK_NEXT : WHITE_NEXT;
-    quadrant_free(q_new, quad_len); /* freeing temporary quadrant */
+    g->state = compute_state(g);
 }
 
-/* helper function used to check if side - 1 in a row exists in the board */
-int in_a_row(game* g, square tag, unsigned char b, pos p) {
-    unsigned int t = 0, checks = g->b->side - 2; /* # of marbles to check */
-    for (unsigned int i = 1; i <= checks; i++) {
-        if (b == 'h') { /* check horizontal */
-            if (tag != board_get(g->b, make_pos(p.r, p.c + i))) {
-                t = 1;
-                break; /* not consecutive, break loop */
-            }
-        } else if (b == 'v'){ /* b == 'v', check vertical */
-            if (tag != board_get(g->b, make_pos(p.r + i, p.c))) {
-                t = 1;
-                break; /* not consecutive, break loop */
+/* helper function that returns condition of a game: whether a game is
+finished or not. If yes, returns who wins/draw. kept up to date by every
+move, so asking again costs nothing */
+int is_game_over(game* g) {
+    return g->state;
+}
+
+int game_over(game* g) {
+    int res = is_game_over(g);
+    return (res == 0) ? 0 : 1; /* non-zero means game is over */
+}
+
+outcome game_outcome(game* g){
+    int res = is_game_over(g);
+    switch (res) {
+        case 1:
+            return WHITE_WIN;
+        case 2:
+            return BLACK_WIN;
+        case 3:
+            return DRAW;
+        default:
+            return DRAW;
+    }
+}
+
+unsigned int generate_moves(game* g, move* out) {
+    unsigned int n = 0, cells = g->b->side * g->b->side, cell, k;
+    if (g->state != 0) {
+        return 0; /* nothing to play once the game is over */
+    }
+    if (g->b->type == MASKS) { /* walk the empty bits only */
+        uint64_t empty = ~(g->b->u.masks[0] | g->b->u.masks[1]);
+        if (cells < 64) {
+            empty &= ((uint64_t)1 << cells) - 1;
+        }
+        while (empty) {
+            cell = __builtin_ctzll(empty);
+            for (k = 0; k < 8; k++) { /* 4 quadrants x 2 directions */
+                out[n++] = MOVE(cell, k >> 1, k & 1);
             }
-        } else if (b == 'r'){ /* b == 'r', check right diagonal */
-            if (tag!= board_get(g->b, make_pos(p.r + i, p.c + i))) {
-                t = 1;
-                break;
+            empty &= empty - 1;
+        }
+        return n;
+    } else if (g->b->type == LARGE) { /* the same, row by row */
+        unsigned int side = g->b->side, r;
+        uint64_t full = (side < 64) ? ((uint64_t)1 << side) - 1 : ~0ULL;
+        for (r = 0; r < side; r++) {
+            uint64_t empty = ~(g->b->u.rows[r] | g->b->u.rows[side + r])
+                           & full;
+            while (empty) {
+                cell = (r * side) + __builtin_ctzll(empty);
+                for (k = 0; k < 8; k++) {
+                    out[n++] = MOVE(cell, k >> 1, k & 1);
+                }
+                empty &= empty - 1;
             }
-        } else { /* b == 'l', check left diagonal */
-            if (tag!= board_get(g->b, make_pos(p.r + i, p.c - i))) {
-                t = 1;
-                break;
+        }
+        return n;
+    }
+    for (cell = 0; cell < cells; cell++) {
+        pos p = make_pos(cell / g->b->side, cell % g->b->side);
+        if (board_get(g->b, p) == EMPTY) {
+            for (k = 0; k < 8; k++) {
+                out[n++] = MOVE(cell, k >> 1, k & 1);
             }
         }
     }
-    return (t == 1) ? 0 : 1; /* not consecutive = return 0 */
+    return n;
 }
 
-/* helper function used to check if board is completely filled */
-int is_board_full(game* g) {
-    for (unsigned int r = 0; r < g->b->side; r++) {
-        for (unsigned int c = 0; c < g->b->side; c++) {
-            if (board_get(g->b, make_pos(r, c)) == EMPTY) {
-                return 0; /* board is not full */
+/* helper function that returns 1 if the player to move completes a line
+by placing on cell, so the twist would be skipped. with cell past the last
+one, returns 1 if any line is a placement away from being completed */
+static int placement_wins(game* g, unsigned int cell) {
+    const lines* l = g->lines;
+    unsigned int own = (g->next == WHITE_NEXT) ? 1 : 0, i;
+    if (cell >= g->b->side * g->b->side) {
+        for (i = 0; i < l->count; i++) {
+            const unsigned char* n = &g->counts[2 * i];
+            if (n[own] + 1 == l->len && n[!own] == 0) {
+                return 1;
             }
         }
+        return 0;
+    }
+    const unsigned int* through = &l->cell_lines[cell * LINES_PER_CELL];
+    for (i = 0; i < l->per_cell[cell]; i++) {
+        const unsigned char* n = &g->counts[2 * through[i]];
+        if (n[own] + 1 == l->len && n[!own] == 0) {
+            return 1;
+        }
     }
-    return 1; /* board is full */
+    return 0;
 }
 
-/* helper function that returns condition of a game: whether a game is
-finished or not. If yes, returns who wins/draw */
-int is_game_over(game* g) {
-    unsigned int w = 0, b = 0, r, c;
-    unsigned char h = 'h', v = 'v', rd = 'r', ld = 'l';
-    /* check horizontal */
-    for (r = 0; r < g->b->side; r++) {
-        for (c = 0; c <= 1; c++) {
-            square tag = board_get(g->b, make_pos(r, c));
-            if ((tag != EMPTY) && in_a_row(g, tag, h, make_pos(r, c))) {
-                (tag == WHITE) ? w++ : b++;
-            }
+int can_win_by_placement(game* g) {
+    return g->state == 0 && placement_wins(g, g->b->side * g->b->side);
+}
+
+/* helper function that keeps the first of the n moves at out to reach each
+position, playing each one to hash it. returns how many are left */
+static unsigned int unique_by_hash(game* g, move* out, unsigned int n) {
+    uint64_t seen[1024]; /* open addressing, at most half full */
+    unsigned int kept = 0, i;
+    memset(seen, 0, sizeof(seen));
+    for (i = 0; i < n; i++) {
+        make_move(g, out[i]);
+        uint64_t h = game_hash(g) | 1; /* 0 marks an empty slot */
+        unmake_move(g, out[i]);
+        unsigned int slot = (unsigned int)(h >> 54);
+        while (seen[slot] != 0 && seen[slot] != h) {
+            slot = (slot + 1) & 1023;
         }
-    }
-    /* check vertical */
-    for (c = 0; c < g->b->side; c++) {
-        for (r = 0; r <= 1; r++) {
-            square tag = board_get(g->b, make_pos(r, c));
-            if ((tag != EMPTY) && in_a_row(g, tag, v, make_pos(r, c))) {
-                (tag == WHITE) ? w++ : b++;
-            }
+        if (seen[slot] == 0) {
+            seen[slot] = h;
+            out[kept++] = out[i];
         }
     }
-    /* check right diagonal: need to check (0,0), (0,1), (1,0), (1,1) */
-    for (r = 0; r <= 1; r++) {
-        for (c = 0; c <= 1; c++) {
-            square tag = board_get(g->b, make_pos(r, c));
-            if ((tag != EMPTY) && in_a_row(g, tag, rd, make_pos(r, c))) {
-                (tag == WHITE) ? w++ : b++;
+    return kept;
+}
+
+/* helper function that writes the low three bits (quadrant and direction)
+of the twists worth trying given each quadrant's symmetry counts, and
+returns how many: one twist of any quadrant a quarter turn leaves alone,
+only clockwise for those a half turn leaves alone, both for the rest */
+static unsigned int twist_choices(const int* a90, const int* a180,
+unsigned char* out) {
+    unsigned int n = 0, q;
+    int still = 0; /* a no-op twist has been written */
+    for (q = 0; q < 4; q++) {
+        if (a90[q] == 0) {
+            if (!still) {
+                out[n++] = (unsigned char)MOVE(0, q, CW);
+                still = 1;
+            }
+        } else {
+            out[n++] = (unsigned char)MOVE(0, q, CW);
+            if (a180[q] != 0) {
+                out[n++] = (unsigned char)MOVE(0, q, CCW);
             }
         }
     }
-    /* left diagonal: need to check (0,len), (0,len-1), (1,len), (1,len-1) */
-    for (r = 0; r <= 1; r++) {
-        for (c = g->b->side - 2; c <= g->b->side - 1; c++) {
-            square tag = board_get(g->b, make_pos(r, c));
-            if ((tag != EMPTY) && in_a_row(g, tag, ld, make_pos(r, c))) {
-                (tag == WHITE) ? w++ : b++;
+    return n;
+}
+
+unsigned int generate_unique_moves(game* g, move* out, int by_hash) {
+    unsigned int side = g->b->side, count = 0, q, k;
+    square own = (g->next == WHITE_NEXT) ? WHITE : BLACK;
+    move* all = out; /* every move, overwritten in place as we go */
+    unsigned int total = generate_moves(g, all), i;
+    int a90[4], a180[4];
+    for (q = 0; q < 4; q++) {
+        a90[q] = g->asym90[q], a180[q] = g->asym180[q];
+    }
+    unsigned char base[8], mine[8];
+    unsigned int nbase = twist_choices(a90, a180, base);
+    int may_win = placement_wins(g, side * side);
+    for (i = 0; i < total; i += 8) { /* 8 twists per empty cell, in order */
+        unsigned int cell = MOVE_CELL(all[i]);
+        pos p = make_pos(cell / side, cell % side);
+        if (may_win && placement_wins(g, cell)) {
+            out[count++] = MOVE(cell, NW, CW);
+            continue;
+        }
+        /* the placement changes the counts of its own quadrant only, by
+        at most one, which only matters if one of them could reach zero */
+        const unsigned char* t = base;
+        unsigned int nt = nbase;
+        q = quadrant_of(p, side / 2);
+        if (a90[q] <= 1 || a180[q] <= 1) {
+            int d90, d180;
+            orbit_change(g, p, EMPTY, own, &d90, &d180);
+            if (d90 != 0 || d180 != 0) {
+                a90[q] += d90, a180[q] += d180;
+                nt = twist_choices(a90, a180, mine);
+                t = mine;
+                a90[q] -= d90, a180[q] -= d180;
             }
         }
+        for (k = 0; k < nt; k++) {
+            out[count++] = (cell << 3) | t[k];
+        }
     }
-    /* who wins? */
-    if (w != 0 && b == 0) {
-        return 1; /* 1 = white wins */
-    } else if (w == 0 && b != 0) {
-        return 2; /* 2 = black wins */
-    } else if (((w==0 && b==0) && (is_board_full(g)))|| (w!=0 && b!=0)) {
-        return 3; /* 3 = draw, board is full + no win or multiple win */
+    if (by_hash && side <= 8) { /* at most 512 moves, a half-full table */
+        count = unique_by_hash(g, out, count);
+    }
+    return count;
+}
+
+void make_move(game* g, move m) {
+    unsigned int cell = MOVE_CELL(m);
+    place_marble(g, make_pos(cell / g->b->side, cell % g->b->side));
+    if (g->state == 1 || g->state == 2) { /* placement won, game ends */
+        g->skipped = 1;
+        g->next = (g->next == WHITE_NEXT) ? BLACK_NEXT : WHITE_NEXT;
     } else {
-        return 0; /* 0 = game is not over */
+        twist_quadrant(g, MOVE_QUADRANT(m), MOVE_DIRECTION(m));
     }
 }
 
-int game_over(game* g) {
-    int res = is_game_over(g);
-    return (res == 0) ? 0 : 1; /* non-zero means game is over */
+void unmake_move(game* g, move m) {
+    unsigned int cell = MOVE_CELL(m);
+    if (g->skipped) { /* only the final move of a game can skip its twist */
+        g->skipped = 0;
+        g->next = (g->next == WHITE_NEXT) ? BLACK_NEXT : WHITE_NEXT;
+    } else { /* the opposite twist undoes it and flips the turn back */
+        twist_quadrant(g, MOVE_QUADRANT(m),
+                       (MOVE_DIRECTION(m) == CW) ? CCW : CW);
+    }
+    set_cell(g, make_pos(cell / g->b->side, cell % g->b->side), EMPTY);
+    g->state = compute_state(g);
 }
 
-outcome game_outcome(game* g){
-    int res = is_game_over(g);
-    switch (res) {
-        case 1:
-            return WHITE_WIN;
-        case 2:
-            return BLACK_WIN;
-        case 3:
-            return DRAW;
-        default:
-            return DRAW;
+/* hash of BLACK being the player to move */
+#define BLACK_TO_MOVE_KEY 0x6a09e667f3bcc909ULL
+
+uint64_t game_hash(game* g) {
+    return g->b->hash ^ ((g->next == BLACK_NEXT) ? BLACK_TO_MOVE_KEY : 0);
+}
+
+uint64_t game_canonical_hash(game* g, unsigned int* sym) {
+    uint64_t h = board_canonical_hash(g->b, sym);
+    return h ^ ((g->next == BLACK_NEXT) ? BLACK_TO_MOVE_KEY : 0);
+}
+
+move move_symmetry(move m, unsigned int side, unsigned int sym) {
+    unsigned int half = side / 2, cell = MOVE_CELL(m), r_offset, c_offset;
+    pos p = board_symmetry(make_pos(cell / side, cell % side), side, sym);
+    /* the quadrant is wherever its top-left cell lands */
+    find_offsets(&r_offset, &c_offset, MOVE_QUADRANT(m), half);
+    pos corner = board_symmetry(make_pos(r_offset, c_offset), side, sym);
+    unsigned int q = ((corner.r >= half) ? 2 : 0) + ((corner.c >= half) ? 1 : 0);
+    unsigned int d = (sym >= 4) ? !MOVE_DIRECTION(m) : MOVE_DIRECTION(m);
+    return MOVE((p.r * side) + p.c, q, d);
+}
+
+unsigned int symmetry_inverse(unsigned int sym) {
+    /* quarter turns undo each other, mirrored symmetries undo themselves */
+    return (sym < 4) ? (4 - sym) % 4 : sym;
+}
+
+unsigned long perft(game* g, unsigned int depth, move* buffer) {
+    if (depth == 0) {
+        return 1;
+    }
+    unsigned int n = generate_moves(g, buffer), i;
+    if (depth == 1) {
+        return n; /* no need to play the last ply */
+    }
+    unsigned long nodes = 0;
+    for (i = 0; i < n; i++) {
+        make_move(g, buffer[i]);
+        nodes += perft(g, depth - 1, buffer + MAX_MOVES(g->b->side));
+        unmake_move(g, buffer[i]);
+    }
+    return nodes;
+}
+
+void game_to_string(game* g, char* out) {
+    unsigned int side = g->b->side, cell = 0;
+    const char marks[3] = {'.', 'b', 'w'}; /* EMPTY, BLACK, WHITE */
+    for (unsigned int r = 0; r < side; r++) {
+        for (unsigned int c = 0; c < side; c++) {
+            out[cell++] = marks[board_get(g->b, make_pos(r, c))];
+        }
+    }
+    out[cell++] = ' ';
+    out[cell++] = (g->next == WHITE_NEXT) ? 'w' : 'b';
+    out[cell] = '\0';
+}
+
+int game_from_string(game* g, const char* text) {
+    unsigned int side = g->b->side, cells = side * side, cell;
+    for (cell = 0; cell < cells; cell++) { /* check it all before changing g */
+        if (text[cell] != '.' && text[cell] != 'w' && text[cell] != 'b') {
+            return -1;
+        }
+    }
+    char mover = (text[cells] == ' ') ? text[cells + 1] : '\0';
+    if (mover != 'w' && mover != 'b') {
+        return -1;
+    }
+    char after = text[cells + 2];
+    if (after != '\0' && after != ' ' && after != '\t' && after != '\n'
+        && after != '\r') {
+        return -1;
+    }
+    game_reset(g);
+    for (cell = 0; cell < cells; cell++) {
+        if (text[cell] != '.') {
+            set_cell(g, make_pos(cell / side, cell % side),
+                     (text[cell] == 'w') ? WHITE : BLACK);
+        }
+    }
+    g->next = (mover == 'w') ? WHITE_NEXT : BLACK_NEXT;
+    g->state = compute_state(g);
+    return 0;
+}
+
+/* games of one side and type carved out of a single block. each slot holds
+the board, the game and its line counts, then the board's outside buffer,
+every part starting on a cache line so slots never share one */
+struct game_arena {
+    unsigned int side;
+    enum type type;
+    unsigned int capacity;
+    size_t slot_bytes;
+    size_t board_at, game_at, counts_at, outside_at; /* offsets in a slot */
+    unsigned char* block;
+    game** free_slots;     /* stack of the slots not handed out */
+    unsigned int free_count;
+    unsigned char* in_use; /* per slot, to catch stray releases */
+};
+
+/* helper function that rounds n up to whole cache lines */
+static size_t lines_of(size_t n) {
+    return (n + 63) & ~(size_t)63;
+}
+
+game_arena* game_arena_new(unsigned int side, enum type type,
+unsigned int capacity) {
+    if (capacity == 0 || board_invalid(side, type) != NULL) {
+        return NULL;
+    }
+    game_arena* a = (game_arena*)malloc(sizeof(game_arena));
+    if (a == NULL) {
+        return NULL;
+    }
+    size_t outside = board_outside_bytes(side, type);
+    a->side = side;
+    a->type = type;
+    a->capacity = capacity;
+    a->board_at = 0;
+    a->game_at = lines_of(sizeof(board));
+    a->counts_at = a->game_at + lines_of(sizeof(game));
+    a->outside_at = a->counts_at + lines_of(2 * lines_get(side)->count);
+    a->slot_bytes = a->outside_at + lines_of(outside);
+    if (a->slot_bytes > SIZE_MAX / capacity) {
+        free(a);
+        return NULL;
+    }
+    a->block = (unsigned char*)aligned_alloc(64, a->slot_bytes * capacity);
+    a->free_slots = (game**)malloc(capacity * sizeof(game*));
+    a->in_use = (unsigned char*)calloc(capacity, 1);
+    if (a->block == NULL || a->free_slots == NULL || a->in_use == NULL) {
+        free(a->block);
+        free(a->free_slots);
+        free(a->in_use);
+        free(a);
+        return NULL;
+    }
+    for (unsigned int i = 0; i < capacity; i++) { /* wire every slot once */
+        unsigned char* slot = a->block + ((size_t)i * a->slot_bytes);
+        board* b = (board*)(slot + a->board_at);
+        game* g = (game*)(slot + a->game_at);
+        board_init(b, side, type, outside ? slot + a->outside_at : NULL);
+        game_init(g, b, slot + a->counts_at);
+        a->free_slots[capacity - 1 - i] = g; /* slot 0 is handed out first */
+    }
+    a->free_count = capacity;
+    return a;
+}
+
+game* game_arena_alloc(game_arena* a) {
+    if (a->free_count == 0) {
+        return NULL;
+    }
+    game* g = a->free_slots[--a->free_count];
+    a->in_use[((unsigned char*)g - a->block) / a->slot_bytes] = 1;
+    game_reset(g);
+    return g;
+}
+
+int game_arena_release(game_arena* a, game* g) {
+    size_t at = (size_t)((unsigned char*)g - a->block);
+    if ((unsigned char*)g < a->block || at >= a->slot_bytes * a->capacity
+        || at % a->slot_bytes != a->game_at
+        || !a->in_use[at / a->slot_bytes]) {
+        return -1; /* not one of this arena's games, or released twice */
+    }
+    a->in_use[at / a->slot_bytes] = 0;
+    eval_detach(g);
+    a->free_slots[a->free_count++] = g;
+    return 0;
+}
+
+unsigned int game_arena_used(const game_arena* a) {
+    return a->capacity - a->free_count;
+}
+
+void game_arena_free(game_arena* a) {
+    for (unsigned int i = 0; i < a->capacity; i++) {
+        eval_detach((game*)(a->block + ((size_t)i * a->slot_bytes)
+                            + a->game_at));
     }
+    free(a->block);
+    free(a->free_slots);
+    free(a->in_use);
+    free(a);
 }
@@ -2,6 +2,7 @@
 #define _LOGIC_H
 
 #include "board.h"
+#include "lines.h"
 
 
 enum turn {
@@ -34,19 +35,68 @@ enum direction {
 typedef enum direction direction;
 
 
+/* a marble placement followed by a twist, packed into 16 bits: the cell
+number (r * side) + c, then two bits of quadrant and one of direction.
+cell numbers fit for sides up to 90 */
+typedef uint16_t move;
+
+#define MOVE(cell, q, d) ((move)(((cell) << 3) | ((q) << 1) | (d)))
+#define MOVE_CELL(m) ((unsigned int)(m) >> 3)
+#define MOVE_QUADRANT(m) ((quadrant)(((m) >> 1) & 3))
+#define MOVE_DIRECTION(m) ((direction)((m) & 1))
+
+/* stands for no move where one may be absent. 0 is the legal move 00NW1,
+and no cell of a side up to 90 encodes to this */
+#define MOVE_NONE ((move)0xffff)
+
+/* most moves a position on a board of inputted side can have */
+#define MAX_MOVES(side) ((side) * (side) * 8)
+
+
 struct game {
     board* b;
     turn next;
+    const lines* lines;    /* winning lines for the board's side */
+    unsigned char* counts; /* marbles on each line: BLACK at 2i, WHITE 2i+1 */
+    unsigned int wins[2];  /* complete lines of BLACK and WHITE */
+    unsigned int filled;   /* number of occupied cells */
+    int state;             /* cached result of is_game_over */
+    int skipped;           /* last move's placement won, so no twist ran */
+    struct evaluator* ev;  /* incremental evaluation (eval.h), or NULL */
+    /* per quadrant: rings of four cells a quarter turn cycles that are not
+    all one colour, and pairs of cells a half turn swaps that differ. no
+    such rings means twisting it does nothing, no such pairs means both
+    directions give the same result */
+    unsigned short asym90[4];
+    unsigned short asym180[4];
 };
 
 typedef struct game game;
 
-/* creates new empty game of inputted size and type, white goes first */
+/* creates new empty game of inputted size and type, white goes first.
+the board must only be changed through place_marble and twist_quadrant so
+that the line counts and cached outcome stay in step with it */
 game* new_game(unsigned int side, enum type type);
 
 /* frees a game */
 void game_free(game* g);
 
+/* takes a game back to the empty starting position in place, so one game
+can be reused for many without allocating */
+void game_reset(game* g);
+
+/* sets dst to the position of src, which must have the same side but may
+use another type, e.g. to play on a faster representation. never allocates */
+void game_load(game* dst, game* src);
+
+/* makes a new game in the same state as g, sharing nothing mutable */
+game* game_clone(game* g);
+
+/* overwrites dst with the state of src, both must have the same side and
+type. never allocates. dst keeps its own evaluator, if any, brought up to
+date with the copied position */
+void game_copy(game* dst, game* src);
+
 /* places marble in given position according to player's return
 if successful place, return 1. if occupied, does nothing & returns 0 */
 int place_marble(game* g, pos p);
@@ -61,4 +111,88 @@ int game_over(game* g);
 /* returns outcome (black win/ white win/ draw) depending on game state */
 outcome game_outcome(game* g);
 
+/* returns a hash of the position and the player to move */
+uint64_t game_hash(game* g);
+
+/* like game_hash, but equal for all 8 symmetric images of the position.
+sym gets the board symmetry that maps g onto the image that was hashed */
+uint64_t game_canonical_hash(game* g, unsigned int* sym);
+
+/* maps move m through board symmetry sym (see board_symmetry), mirrors
+turn clockwise twists into counter-clockwise ones */
+move move_symmetry(move m, unsigned int side, unsigned int sym);
+
+/* returns the symmetry that undoes sym */
+unsigned int symmetry_inverse(unsigned int sym);
+
+/* writes every legal move of the player to move into out, which must have
+room for MAX_MOVES(side) moves, and returns how many there are. a finished
+game has no moves */
+unsigned int generate_moves(game* g, move* out);
+
+/* like generate_moves, but leaves out moves known to give the same
+position as one already written: every twist after a placement that wins
+(the twist is skipped), all but one twist of quadrants a quarter turn
+leaves unchanged, and the counter-clockwise twist of quadrants a half turn
+leaves unchanged, read from the quadrant symmetry counts. with by_hash, on
+sides up to 8 it also plays each remaining move and keeps only the first
+to reach each position hash */
+unsigned int generate_unique_moves(game* g, move* out, int by_hash);
+
+/* returns 1 if the player to move in g, a game still going, can win by
+placing a marble alone, without needing a twist. reads the line counts
+only, so it is a cheap test for a win in one move, though one that misses
+wins a twist completes */
+int can_win_by_placement(game* g);
+
+/* plays a move: places the marble, then twists unless the placement alone
+won the game (the twist is skipped, as in play). flips the turn */
+void make_move(game* g, move m);
+
+/* takes back the last move made with make_move, restoring the board, turn,
+line counts and outcome exactly. never allocates */
+void unmake_move(game* g, move m);
+
+/* counts the positions depth plies below g (perft), playing every move
+with make_move and taking it back. buffer needs room for depth times
+MAX_MOVES(side) moves. g is left as it was */
+unsigned long perft(game* g, unsigned int depth, move* buffer);
+
+struct game_arena;
+
+typedef struct game_arena game_arena;
+
+/* makes room for capacity games of inputted side and type in one block,
+with every board and line table wired up front. returns NULL instead of
+exiting if the side or type is invalid, capacity is 0 or memory is short,
+so a long-running job can carry on */
+game_arena* game_arena_new(unsigned int side, enum type type,
+                           unsigned int capacity);
+
+/* hands out an empty game from the arena in constant time, or NULL when
+every slot is in use. it must go back through game_arena_release, never
+game_free */
+game* game_arena_alloc(game_arena* a);
+
+/* takes g back into the arena in constant time, dropping its evaluator if
+it has one. returns 0, or -1 if g was not handed out by this arena */
+int game_arena_release(game_arena* a, game* g);
+
+/* returns the number of games handed out and not yet released */
+unsigned int game_arena_used(const game_arena* a);
+
+/* frees the arena and every game in it, released or not */
+void game_arena_free(game_arena* a);
+
+/* writes the position of g to out as one line of text: every cell row by
+row ('.' empty, 'w' white, 'b' black), a space, then 'w' or 'b' for the
+player to move. out needs room for side * side + 3 characters */
+void game_to_string(game* g, char* out);
+
+/* sets g to the position text describes in the form game_to_string
+writes, for the side of g. whatever follows the player to move after a
+space (a result from -dump, say) is ignored. returns 0, or -1 leaving g
+as it was if text is not a position of that side. never allocates */
+int game_from_string(game* g, const char* text);
+
 #endif /* _LOGIC_H */
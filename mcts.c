@@ -0,0 +1,393 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "mcts.h"
+#include "sim.h"
+
+/* visits a leaf needs before it is expanded, so one-off leaves stay cheap */
+#define MCTS_EXPAND_AT 2
+
+/* UCT exploration constant, results are scored 0 to 1 */
+#define MCTS_EXPLORE 1.0
+
+
+/* a tree node: the move that led to it and what playouts through it made of
+that move. children of a node sit next to each other in the pool */
+struct node {
+    atomic_uint visits;   /* playouts through here, plus ones in flight */
+    atomic_uint score;    /* 2 per win and 1 per draw for the mover */
+    atomic_uint first;    /* pool index of the first child, 0 if none yet */
+    atomic_int expanding; /* claimed by the thread that expands it */
+    uint16_t count;       /* children */
+    move m;
+};
+
+/* what each thread keeps for itself during a run */
+struct worker {
+    struct mcts* m;
+    game* g;           /* descends from the root with make/unmake */
+    game* scratch;     /* each playout runs on a copy of the leaf */
+    move* moves;       /* room for MAX_MOVES(side) */
+    unsigned int* path; /* pool indices from the root to the leaf */
+    rng r;
+    unsigned long playouts;
+};
+
+struct mcts {
+    unsigned int side;
+    enum type fast;        /* representation the threads play on */
+    unsigned int threads;
+    unsigned int batch;    /* playouts per leaf */
+    struct node* pool[2];  /* tree, and room to compact it between moves */
+    unsigned int cur;      /* which pool holds the tree */
+    unsigned int capacity; /* nodes in each pool */
+    atomic_uint used;
+    game* root;            /* position at the root, on fast */
+    int have_root;
+    struct worker* workers;
+    pthread_t* ids;
+    atomic_int stop;
+    atomic_ulong playouts;
+    unsigned long max_playouts;
+    double deadline;       /* monotonic seconds, 0 for none */
+};
+
+/* helper function that returns monotonic time in seconds */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+mcts* mcts_new(unsigned int side, enum type type, unsigned int threads,
+size_t pool_mb, unsigned int batch) {
+    mcts* m = (mcts*)malloc(sizeof(mcts));
+    if (m == NULL || threads == 0 || batch == 0) {
+        fprintf(stderr, "mcts_new: need at least one thread and playout.\n");
+        exit(1);
+    }
+    size_t n = ((pool_mb << 20) / 2) / sizeof(struct node);
+    if (n < 2 + MAX_MOVES(side)) {
+        fprintf(stderr, "mcts_new: pool too small for one expansion.\n");
+        exit(1);
+    }
+    m->side = side;
+    m->fast = (side <= 8) ? MASKS : type;
+    m->threads = threads;
+    m->batch = batch;
+    m->capacity = (n > 0xffffffffu) ? 0xffffffffu : (unsigned int)n;
+    m->pool[0] = (struct node*)malloc(m->capacity * sizeof(struct node));
+    m->pool[1] = (struct node*)malloc(m->capacity * sizeof(struct node));
+    m->workers = (struct worker*)calloc(threads, sizeof(struct worker));
+    m->ids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    if (m->pool[0] == NULL || m->pool[1] == NULL || m->workers == NULL
+        || m->ids == NULL) {
+        fprintf(stderr, "mcts_new: malloc failed.\n");
+        exit(1);
+    }
+    m->cur = 0;
+    atomic_init(&m->used, 0);
+    m->root = new_game(side, m->fast);
+    m->have_root = 0;
+    for (unsigned int i = 0; i < threads; i++) {
+        struct worker* w = &m->workers[i];
+        w->m = m;
+        w->g = new_game(side, m->fast);
+        w->scratch = new_game(side, m->fast);
+        w->moves = (move*)malloc(MAX_MOVES(side) * sizeof(move));
+        w->path = (unsigned int*)malloc((side * side + 2)
+                                        * sizeof(unsigned int));
+        if (w->moves == NULL || w->path == NULL) {
+            fprintf(stderr, "mcts_new: malloc failed.\n");
+            exit(1);
+        }
+        rng_seed(&w->r, i + 1);
+    }
+    atomic_init(&m->stop, 0);
+    atomic_init(&m->playouts, 0);
+    return m;
+}
+
+void mcts_free(mcts* m) {
+    for (unsigned int i = 0; i < m->threads; i++) {
+        game_free(m->workers[i].g);
+        game_free(m->workers[i].scratch);
+        free(m->workers[i].moves);
+        free(m->workers[i].path);
+    }
+    game_free(m->root);
+    free(m->pool[0]);
+    free(m->pool[1]);
+    free(m->workers);
+    free(m->ids);
+    free(m);
+}
+
+/* helper function that sets up node n as an unvisited leaf for move mv */
+static void node_init(struct node* n, move mv) {
+    atomic_init(&n->visits, 0);
+    atomic_init(&n->score, 0);
+    atomic_init(&n->first, 0);
+    atomic_init(&n->expanding, 0);
+    n->count = 0;
+    n->m = mv;
+}
+
+/* helper function that picks the child of n with the best UCT bound. an
+unvisited child wins outright; since a thread counts its visit before it
+plays out, others see the visit as a loss and spread to other children */
+static unsigned int select_child(struct node* pool, struct node* n) {
+    unsigned int first = atomic_load_explicit(&n->first, memory_order_acquire);
+    double log_n = log((double)atomic_load_explicit(&n->visits,
+                                                    memory_order_relaxed));
+    double best_value = -1.0;
+    unsigned int best = first;
+    for (unsigned int i = first; i < first + n->count; i++) {
+        unsigned int v = atomic_load_explicit(&pool[i].visits,
+                                              memory_order_relaxed);
+        if (v == 0) {
+            return i;
+        }
+        double s = atomic_load_explicit(&pool[i].score, memory_order_relaxed);
+        double value = (s / (2.0 * v)) + MCTS_EXPLORE * sqrt(log_n / v);
+        if (value > best_value) {
+            best_value = value, best = i;
+        }
+    }
+    return best;
+}
+
+/* helper function that gives leaf n its children, unless another thread is
+already doing so or the pool is full. returns 1 if n has children now */
+static int expand(mcts* m, struct worker* w, struct node* n) {
+    int idle = 0;
+    if (!atomic_compare_exchange_strong(&n->expanding, &idle, 1)) {
+        return 0;
+    }
+    /* expansions are rare next to playouts, so weeding out every repeat
+    position is worth playing each move once here */
+    unsigned int count = generate_unique_moves(w->g, w->moves, 1);
+    if ((unsigned long)atomic_load(&m->used) + count > m->capacity) {
+        return 0; /* pool full: n stays a leaf, claimed for good */
+    }
+    unsigned int base = atomic_fetch_add(&m->used, count);
+    if ((unsigned long)base + count > m->capacity) {
+        return 0; /* lost a race for the last room */
+    }
+    struct node* pool = m->pool[m->cur];
+    for (unsigned int i = 0; i < count; i++) {
+        node_init(&pool[base + i], w->moves[i]);
+    }
+    n->count = (uint16_t)count;
+    atomic_store_explicit(&n->first, base, memory_order_release);
+    return 1;
+}
+
+/* helper function that scores the finished game g in points for the white
+(index 1) and black (index 0) player: 2 per win, 1 per draw */
+static void add_result(game* g, unsigned int points[2], unsigned int times) {
+    outcome o = game_outcome(g);
+    points[1] += times * ((o == WHITE_WIN) ? 2 : (o == DRAW) ? 1 : 0);
+    points[0] += times * ((o == BLACK_WIN) ? 2 : (o == DRAW) ? 1 : 0);
+}
+
+/* helper function that runs one iteration: select down to a leaf, expand
+it if it has been visited enough, play a batch of playouts from there and
+back the results up the path. returns the number of playouts run */
+static unsigned int iterate(mcts* m, struct worker* w) {
+    struct node* pool = m->pool[m->cur];
+    unsigned int depth = 0, points[2] = {0, 0}, batch = m->batch, i;
+    turn mover = w->g->next; /* made the moves at odd depths */
+    w->path[0] = 0;
+    atomic_fetch_add_explicit(&pool[0].visits, 1, memory_order_relaxed);
+    while (w->g->state == 0) {
+        struct node* n = &pool[w->path[depth]];
+        if (atomic_load_explicit(&n->first, memory_order_acquire) == 0) {
+            if (atomic_load_explicit(&n->visits, memory_order_relaxed)
+                < MCTS_EXPAND_AT || !expand(m, w, n)) {
+                break; /* n is the leaf */
+            }
+        }
+        unsigned int c = select_child(pool, n);
+        atomic_fetch_add_explicit(&pool[c].visits, 1, memory_order_relaxed);
+        make_move(w->g, pool[c].m);
+        w->path[++depth] = c;
+    }
+    if (w->g->state != 0) { /* the tree reached the end of the game */
+        add_result(w->g, points, batch);
+    } else {
+        for (i = 0; i < batch; i++) {
+            game_copy(w->scratch, w->g);
+            sim_playout(w->scratch, &w->r, RANDOM, NULL);
+            add_result(w->scratch, points, 1);
+        }
+    }
+    for (i = depth; i > 0; i--) {
+        struct node* n = &pool[w->path[i]];
+        turn t = (i & 1) ? mover : !mover; /* who moved into n */
+        /* the visit counted on the way down becomes batch real ones */
+        atomic_fetch_add_explicit(&n->visits, batch - 1,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&n->score, points[t == WHITE_NEXT],
+                                  memory_order_relaxed);
+        unmake_move(w->g, n->m);
+    }
+    atomic_fetch_add_explicit(&pool[0].visits, batch - 1,
+                              memory_order_relaxed);
+    return batch;
+}
+
+/* thread body: iterates until the playout budget, the deadline or another
+thread stops the run */
+static void* worker_main(void* arg) {
+    struct worker* w = (struct worker*)arg;
+    mcts* m = w->m;
+    while (!atomic_load_explicit(&m->stop, memory_order_relaxed)) {
+        unsigned int n = iterate(m, w);
+        w->playouts += n;
+        unsigned long total = atomic_fetch_add_explicit(&m->playouts, n,
+                                  memory_order_relaxed) + n;
+        if ((m->max_playouts && total >= m->max_playouts)
+            || (m->deadline > 0 && now_seconds() >= m->deadline)) {
+            atomic_store(&m->stop, 1);
+        }
+    }
+    return NULL;
+}
+
+/* helper function that finds the node for position g among the root, its
+children and grandchildren, or returns 0 if g is not in the tree. the
+root is index 0, so 0 doubles as not found for anything but the root */
+static int find_subtree(mcts* m, game* g, unsigned int* found) {
+    struct node* pool = m->pool[m->cur];
+    game* t = m->workers[0].g;
+    uint64_t target = game_hash(g);
+    game_copy(t, m->root);
+    if (game_hash(t) == target) {
+        *found = 0;
+        return 1;
+    }
+    unsigned int first = atomic_load(&pool[0].first), i, j;
+    for (i = first; first && i < first + pool[0].count; i++) {
+        make_move(t, pool[i].m);
+        if (game_hash(t) == target) {
+            *found = i;
+            return 1;
+        }
+        unsigned int f = atomic_load(&pool[i].first);
+        for (j = f; f && j < f + pool[i].count; j++) {
+            make_move(t, pool[j].m);
+            if (game_hash(t) == target) {
+                *found = j;
+                return 1;
+            }
+            unmake_move(t, pool[j].m);
+        }
+        unmake_move(t, pool[i].m);
+    }
+    return 0;
+}
+
+/* helper function that copies the subtree under node top into the spare
+pool breadth first, so every node's children stay contiguous, and makes
+it the tree. returns the number of nodes kept */
+static unsigned int compact(mcts* m, unsigned int top) {
+    struct node* from = m->pool[m->cur];
+    struct node* to = m->pool[!m->cur];
+    unsigned int used = 1, next;
+    to[0] = from[top];
+    atomic_store(&to[0].first, 0);
+    atomic_store(&to[0].expanding, 0);
+    for (next = 0; next < used; next++) { /* to[next] came from old */
+        unsigned int old = (next == 0) ? top : atomic_load(&to[next].first);
+        unsigned int f = atomic_load(&from[old].first);
+        atomic_store(&to[next].first, 0);
+        atomic_store(&to[next].expanding, 0);
+        if (f == 0) {
+            to[next].count = 0;
+            continue;
+        }
+        for (unsigned int i = 0; i < from[old].count; i++) {
+            to[used + i] = from[f + i];
+            /* until it is visited, a copy's first remembers where it came
+            from */
+            atomic_store(&to[used + i].first, f + i);
+        }
+        atomic_store(&to[next].first, used);
+        atomic_store(&to[next].expanding, 1);
+        used += from[old].count;
+    }
+    m->cur = !m->cur;
+    return used;
+}
+
+mcts_result mcts_run(mcts* m, game* g, unsigned long max_playouts,
+unsigned int movetime_ms) {
+    mcts_result res = {MOVE_NONE, 0, 0.0, 0, 0, 0, 0.0};
+    unsigned int top, i;
+    if (max_playouts == 0 && movetime_ms == 0) {
+        fprintf(stderr, "mcts_run: need a playout or time limit.\n");
+        exit(1);
+    }
+    double start = now_seconds();
+    if (m->have_root && find_subtree(m, g, &top)) {
+        res.reused = compact(m, top);
+        atomic_store(&m->used, (unsigned int)res.reused);
+    } else { /* start over from a lone root */
+        node_init(&m->pool[m->cur][0], 0);
+        atomic_store(&m->used, 1);
+    }
+    game_load(m->root, g);
+    m->have_root = 1;
+    if (g->state != 0) {
+        res.seconds = now_seconds() - start;
+        return res;
+    }
+    atomic_store(&m->stop, 0);
+    atomic_store(&m->playouts, 0);
+    m->max_playouts = max_playouts;
+    m->deadline = movetime_ms ? start + (movetime_ms / 1000.0) : 0;
+    for (i = 0; i < m->threads; i++) {
+        game_copy(m->workers[i].g, m->root);
+        m->workers[i].playouts = 0;
+    }
+    /* the root gets its children now, whatever its visits, so even a run
+    cut short after a playout or two has root moves to choose from */
+    if (atomic_load(&m->pool[m->cur][0].first) == 0) {
+        expand(m, &m->workers[0], &m->pool[m->cur][0]);
+    }
+    for (i = 1; i < m->threads; i++) {
+        if (pthread_create(&m->ids[i], NULL, worker_main,
+                           &m->workers[i]) != 0) {
+            fprintf(stderr, "mcts_run: could not start a thread.\n");
+            exit(1);
+        }
+    }
+    worker_main(&m->workers[0]);
+    for (i = 1; i < m->threads; i++) {
+        pthread_join(m->ids[i], NULL);
+    }
+    struct node* pool = m->pool[m->cur];
+    unsigned int first = atomic_load(&pool[0].first);
+    for (i = first; first && i < first + pool[0].count; i++) {
+        unsigned int v = atomic_load(&pool[i].visits);
+        if (v > res.visits || i == first) {
+            res.best = pool[i].m, res.visits = v;
+            res.value = v ? atomic_load(&pool[i].score) / (2.0 * v) : 0.0;
+        }
+    }
+    if (res.best == MOVE_NONE) { /* no room in the pool for the root's */
+        generate_moves(m->root, m->workers[0].moves);
+        res.best = m->workers[0].moves[0];
+    }
+    res.playouts = atomic_load(&m->playouts);
+    res.nodes = atomic_load(&m->used);
+    if (res.nodes > m->capacity) {
+        res.nodes = m->capacity;
+    }
+    res.seconds = now_seconds() - start;
+    return res;
+}
@@ -0,0 +1,43 @@
+#ifndef _MCTS_H
+#define _MCTS_H
+
+#include <stddef.h>
+#include "logic.h"
+
+
+struct mcts_result {
+    move best;              /* most visited root move, MOVE_NONE if the
+                               game is over */
+    unsigned long visits;   /* playouts that went through best */
+    double value;           /* best's mean result for the mover, 0 to 1 */
+    unsigned long playouts; /* playouts run by this call, all threads */
+    unsigned long nodes;    /* tree nodes in use when the search stopped */
+    unsigned long reused;   /* nodes carried over from the previous move */
+    double seconds;         /* wall time spent */
+};
+
+typedef struct mcts_result mcts_result;
+
+struct mcts;
+
+typedef struct mcts mcts;
+
+/* creates a Monte Carlo tree search for games of inputted side and type
+over threads threads. the tree lives in a node pool of pool_mb megabytes
+allocated here, and each leaf reached is scored by batch random playouts.
+playouts run on the bitmask representation whenever the side allows it */
+mcts* mcts_new(unsigned int side, enum type type, unsigned int threads,
+               size_t pool_mb, unsigned int batch);
+
+/* frees a tree search and its pool */
+void mcts_free(mcts* m);
+
+/* grows the tree from g with UCT selection until max_playouts playouts
+have run (0 for no limit) or movetime_ms milliseconds have passed (0 for
+none), and returns the most visited move. threads descend the one shared
+tree, steering each other apart with virtual losses. if g is the position
+of the last call or two plies past it, the matching subtree is kept */
+mcts_result mcts_run(mcts* m, game* g, unsigned long max_playouts,
+                     unsigned int movetime_ms);
+
+#endif /* _MCTS_H */
@@ -0,0 +1,496 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "nnue.h"
+#include "rng.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NNUE_X86 1
+#endif
+
+static const char nnue_magic[4] = {'P', 'T', 'N', 'N'};
+
+#define NNUE_VERSION 2
+
+/* largest sizes a file may ask for: the accumulator and the second layer
+sums live on the stack while scoring */
+#define NNUE_MAX_HIDDEN 512
+#define NNUE_MAX_L1 64
+
+/* cell changes an accumulator holds back before adding them in */
+#define NNUE_PENDING 64
+
+struct nnue_header {
+    char magic[4];
+    uint8_t version;
+    uint8_t side;
+    uint16_t hidden;
+    uint16_t l1;
+    uint8_t shift;
+    uint8_t unused[53];
+};
+
+_Static_assert(sizeof(struct nnue_header) == 64,
+               "the header must fill the 64 bytes nnue.h documents");
+
+struct nnue {
+    void* map;
+    size_t bytes;
+    unsigned int side;
+    unsigned int cells;
+    unsigned int hidden;
+    unsigned int l1;
+    unsigned int shift;
+    const int16_t* ft_weights;  /* 2 * cells rows of hidden */
+    const int16_t* ft_biases;
+    const int8_t* l1_weights;   /* l1 rows of 2 * hidden */
+    const int32_t* l1_biases;
+    const int8_t* out_weights;
+    const int32_t* out_bias;
+};
+
+struct nnue_acc {
+    const nnue* net;
+    int16_t* sums;              /* WHITE's view, then BLACK's */
+    unsigned int pending;
+    uint16_t changes[NNUE_PENDING]; /* cell << 2 | colour << 1 | added */
+};
+
+/* one set of kernels: adding pending changes into the sums, and the layers
+after the accumulator */
+struct kernels {
+    const char* name;
+    void (*apply)(const nnue* net, int16_t* sums, const uint16_t* changes,
+                  unsigned int n);
+    int (*forward)(const nnue* net, const int16_t* mine,
+                   const int16_t* theirs);
+};
+
+static const struct kernels* active = NULL;
+
+/* helper function that rounds n up to a multiple of 64 */
+static size_t round64(size_t n) {
+    return (n + 63) & ~(size_t)63;
+}
+
+/* helper function that returns how many bytes a file for net takes, and
+points its layers into the file image at base unless base is NULL */
+static size_t lay_out(nnue* net, unsigned char* base) {
+    size_t h = net->hidden, at[6];
+    at[0] = round64(sizeof(struct nnue_header));
+    at[1] = round64(at[0] + (2 * net->cells * h * sizeof(int16_t)));
+    at[2] = round64(at[1] + (h * sizeof(int16_t)));
+    at[3] = round64(at[2] + (net->l1 * 2 * h));
+    at[4] = round64(at[3] + (net->l1 * sizeof(int32_t)));
+    at[5] = round64(at[4] + net->l1);
+    if (base != NULL) {
+        net->ft_weights = (const int16_t*)(base + at[0]);
+        net->ft_biases = (const int16_t*)(base + at[1]);
+        net->l1_weights = (const int8_t*)(base + at[2]);
+        net->l1_biases = (const int32_t*)(base + at[3]);
+        net->out_weights = (const int8_t*)(base + at[4]);
+        net->out_bias = (const int32_t*)(base + at[5]);
+    }
+    return at[5] + sizeof(int32_t);
+}
+
+/* helper function that returns the feature row of a marble of colour s on
+cell, as seen by view (0 for WHITE's, 1 for BLACK's) */
+static unsigned int feature(const nnue* net, unsigned int view,
+unsigned int cell, square s) {
+    unsigned int theirs = (s == WHITE) ? view : !view;
+    return (theirs * net->cells) + cell;
+}
+
+/* portable kernels */
+
+static void apply_scalar(const nnue* net, int16_t* sums,
+const uint16_t* changes, unsigned int n) {
+    unsigned int h = net->hidden, view, k, i;
+    for (view = 0; view < 2; view++) {
+        int16_t* acc = sums + (view * h);
+        for (k = 0; k < n; k++) {
+            square s = (changes[k] & 2) ? WHITE : BLACK;
+            const int16_t* w = net->ft_weights
+                + ((size_t)feature(net, view, changes[k] >> 2, s) * h);
+            if (changes[k] & 1) {
+                for (i = 0; i < h; i++) {
+                    acc[i] += w[i];
+                }
+            } else {
+                for (i = 0; i < h; i++) {
+                    acc[i] -= w[i];
+                }
+            }
+        }
+    }
+}
+
+/* helper function that clips a sum to the 0..127 the next layer takes */
+static int clip(int x) {
+    return (x < 0) ? 0 : (x > 127) ? 127 : x;
+}
+
+static int forward_scalar(const nnue* net, const int16_t* mine,
+const int16_t* theirs) {
+    unsigned int h = net->hidden, j, i;
+    uint8_t in[2 * NNUE_MAX_HIDDEN];
+    for (i = 0; i < h; i++) {
+        in[i] = (uint8_t)clip(mine[i]);
+        in[h + i] = (uint8_t)clip(theirs[i]);
+    }
+    int score = *net->out_bias;
+    for (j = 0; j < net->l1; j++) {
+        const int8_t* w = net->l1_weights + ((size_t)j * 2 * h);
+        int sum = net->l1_biases[j];
+        for (i = 0; i < 2 * h; i++) {
+            sum += in[i] * w[i];
+        }
+        score += clip(sum >> net->shift) * net->out_weights[j];
+    }
+    return score;
+}
+
+static const struct kernels scalar_kernels = {
+    "scalar", apply_scalar, forward_scalar
+};
+
+#ifdef NNUE_X86
+
+/* avx2 kernels: the sums are walked 32 at a time in two registers, every
+pending change added in before they are stored back */
+
+__attribute__((target("avx2")))
+static void apply_avx2(const nnue* net, int16_t* sums,
+const uint16_t* changes, unsigned int n) {
+    unsigned int h = net->hidden, view, k, i;
+    for (view = 0; view < 2; view++) {
+        int16_t* acc = sums + (view * h);
+        for (i = 0; i < h; i += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(acc + i));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(acc + i + 16));
+            for (k = 0; k < n; k++) {
+                square s = (changes[k] & 2) ? WHITE : BLACK;
+                const int16_t* w = net->ft_weights + i
+                    + ((size_t)feature(net, view, changes[k] >> 2, s) * h);
+                __m256i wa = _mm256_loadu_si256((const __m256i*)w);
+                __m256i wb = _mm256_loadu_si256((const __m256i*)(w + 16));
+                if (changes[k] & 1) {
+                    a = _mm256_add_epi16(a, wa);
+                    b = _mm256_add_epi16(b, wb);
+                } else {
+                    a = _mm256_sub_epi16(a, wa);
+                    b = _mm256_sub_epi16(b, wb);
+                }
+            }
+            _mm256_storeu_si256((__m256i*)(acc + i), a);
+            _mm256_storeu_si256((__m256i*)(acc + i + 16), b);
+        }
+    }
+}
+
+/* helper function that clips 32 sums to 0..127 and packs them into bytes,
+in order */
+__attribute__((target("avx2")))
+static __m256i clip_avx2(const int16_t* x) {
+    __m256i zero = _mm256_setzero_si256(), top = _mm256_set1_epi16(127);
+    __m256i a = _mm256_loadu_si256((const __m256i*)x);
+    __m256i b = _mm256_loadu_si256((const __m256i*)(x + 16));
+    a = _mm256_min_epi16(_mm256_max_epi16(a, zero), top);
+    b = _mm256_min_epi16(_mm256_max_epi16(b, zero), top);
+    /* packing works per 128 bit lane, the permute puts them back */
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+}
+
+__attribute__((target("avx2")))
+static int forward_avx2(const nnue* net, const int16_t* mine,
+const int16_t* theirs) {
+    unsigned int h = net->hidden, blocks = (2 * h) / 32, j, i;
+    __m256i in[2 * NNUE_MAX_HIDDEN / 32];
+    for (i = 0; i < h / 32; i++) {
+        in[i] = clip_avx2(mine + (32 * i));
+        in[(h / 32) + i] = clip_avx2(theirs + (32 * i));
+    }
+    __m256i ones = _mm256_set1_epi16(1);
+    int score = *net->out_bias;
+    for (j = 0; j < net->l1; j++) {
+        const int8_t* w = net->l1_weights + ((size_t)j * 2 * h);
+        __m256i sum = _mm256_setzero_si256();
+        for (i = 0; i < blocks; i++) {
+            /* byte pairs multiply into 16 bits without overflow: the
+            inputs are at most 127 */
+            __m256i p = _mm256_maddubs_epi16(
+                in[i], _mm256_loadu_si256((const __m256i*)(w + (32 * i))));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(p, ones));
+        }
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                                  _mm256_extracti128_si256(sum, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+        int total = net->l1_biases[j] + _mm_cvtsi128_si32(s);
+        score += clip(total >> net->shift) * net->out_weights[j];
+    }
+    return score;
+}
+
+static const struct kernels avx2_kernels = {
+    "avx2", apply_avx2, forward_avx2
+};
+
+#endif /* NNUE_X86 */
+
+/* helper function that returns the kernels named isa if the processor can
+run them, NULL otherwise */
+static const struct kernels* find_kernels(const char* isa) {
+#ifdef NNUE_X86
+    __builtin_cpu_init();
+    if (strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        return &avx2_kernels;
+    }
+#endif
+    return (strcmp(isa, "scalar") == 0) ? &scalar_kernels : NULL;
+}
+
+/* helper function that picks the widest kernels the processor can run */
+static const struct kernels* pick_kernels(void) {
+    if (active == NULL) {
+        const struct kernels* k = find_kernels("avx2");
+        active = (k != NULL) ? k : &scalar_kernels;
+    }
+    return active;
+}
+
+const char* nnue_isa(void) {
+    return pick_kernels()->name;
+}
+
+int nnue_use(const char* isa) {
+    const struct kernels* k = find_kernels(isa);
+    if (k == NULL) {
+        return 0;
+    }
+    active = k;
+    return 1;
+}
+
+nnue* nnue_load(const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0
+        || (size_t)st.st_size < sizeof(struct nnue_header)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); /* the mapping stays valid */
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    const struct nnue_header* hd = (const struct nnue_header*)map;
+    nnue* net = (nnue*)malloc(sizeof(nnue));
+    if (net == NULL) {
+        fprintf(stderr, "nnue_load: malloc failed.\n");
+        exit(1);
+    }
+    net->map = map;
+    net->bytes = st.st_size;
+    net->side = hd->side;
+    net->cells = hd->side * hd->side;
+    net->hidden = hd->hidden;
+    net->l1 = hd->l1;
+    net->shift = hd->shift;
+    if (memcmp(hd->magic, nnue_magic, sizeof(hd->magic)) != 0
+        || hd->version != NNUE_VERSION || board_invalid(hd->side, CELLS)
+        || net->hidden == 0 || net->hidden % 32 != 0
+        || net->hidden > NNUE_MAX_HIDDEN || net->l1 == 0
+        || net->l1 > NNUE_MAX_L1 || net->shift > 31
+        || lay_out(net, (unsigned char*)map) != net->bytes) {
+        munmap(map, st.st_size);
+        free(net);
+        return NULL;
+    }
+    pick_kernels();
+    return net;
+}
+
+void nnue_unload(nnue* net) {
+    munmap(net->map, net->bytes);
+    free(net);
+}
+
+unsigned int nnue_side(const nnue* net) {
+    return net->side;
+}
+
+int nnue_write_random(const char* path, unsigned int side,
+unsigned int hidden, uint64_t seed) {
+    nnue net;
+    rng r;
+    size_t i;
+    net.side = side, net.cells = side * side, net.hidden = hidden;
+    net.l1 = 32, net.shift = 6;
+    size_t bytes = lay_out(&net, NULL);
+    unsigned char* image = (unsigned char*)calloc(bytes, 1);
+    if (image == NULL) {
+        fprintf(stderr, "nnue_write_random: malloc failed.\n");
+        exit(1);
+    }
+    lay_out(&net, image);
+    struct nnue_header* hd = (struct nnue_header*)image;
+    memcpy(hd->magic, nnue_magic, sizeof(hd->magic));
+    hd->version = NNUE_VERSION;
+    hd->side = (uint8_t)side;
+    hd->hidden = (uint16_t)hidden;
+    hd->l1 = (uint16_t)net.l1;
+    hd->shift = (uint8_t)net.shift;
+    rng_seed(&r, seed);
+    int16_t* ft = (int16_t*)net.ft_weights;
+    for (i = 0; i < 2 * net.cells * hidden; i++) {
+        ft[i] = (int16_t)rng_below(&r, 33) - 16;
+    }
+    int16_t* ftb = (int16_t*)net.ft_biases;
+    for (i = 0; i < hidden; i++) {
+        ftb[i] = (int16_t)rng_below(&r, 64);
+    }
+    int8_t* w1 = (int8_t*)net.l1_weights;
+    for (i = 0; i < net.l1 * 2 * hidden; i++) {
+        w1[i] = (int8_t)((int)rng_below(&r, 17) - 8);
+    }
+    int8_t* out = (int8_t*)net.out_weights;
+    for (i = 0; i < net.l1; i++) {
+        out[i] = (int8_t)((int)rng_below(&r, 33) - 16);
+    }
+    FILE* f = fopen(path, "wb");
+    int ok = f != NULL && fwrite(image, 1, bytes, f) == bytes;
+    ok = (f != NULL && fclose(f) == 0) && ok;
+    free(image);
+    return ok ? 0 : -1;
+}
+
+nnue_acc* nnue_acc_new(const nnue* net) {
+    nnue_acc* a = (nnue_acc*)malloc(sizeof(nnue_acc));
+    int16_t* sums = (int16_t*)aligned_alloc(64, round64(2 * net->hidden
+                                                 * sizeof(int16_t)));
+    if (a == NULL || sums == NULL) {
+        fprintf(stderr, "nnue_acc_new: malloc failed.\n");
+        exit(1);
+    }
+    a->net = net;
+    a->sums = sums;
+    memcpy(sums, net->ft_biases, net->hidden * sizeof(int16_t));
+    memcpy(sums + net->hidden, net->ft_biases,
+           net->hidden * sizeof(int16_t));
+    a->pending = 0;
+    return a;
+}
+
+void nnue_acc_free(nnue_acc* a) {
+    free(a->sums);
+    free(a);
+}
+
+/* helper function that adds the pending changes into the sums */
+static void flush(nnue_acc* a) {
+    if (a->pending > 0) {
+        active->apply(a->net, a->sums, a->changes, a->pending);
+        a->pending = 0;
+    }
+}
+
+/* helper function that holds back one change, adding the rest in first if
+there is no room. taking away a marble just added cancels out, as when a
+move is unmade */
+static void note(nnue_acc* a, unsigned int cell, square s, int added) {
+    uint16_t code = (uint16_t)((cell << 2) | ((s == WHITE) << 1) | added);
+    if (a->pending > 0 && a->changes[a->pending - 1] == (code ^ 1)) {
+        a->pending--;
+        return;
+    } else if (a->pending == NNUE_PENDING) {
+        flush(a);
+    }
+    a->changes[a->pending++] = code;
+}
+
+void nnue_acc_refresh(nnue_acc* a, board* b) {
+    const nnue* net = a->net;
+    memcpy(a->sums, net->ft_biases, net->hidden * sizeof(int16_t));
+    memcpy(a->sums + net->hidden, net->ft_biases,
+           net->hidden * sizeof(int16_t));
+    a->pending = 0;
+    for (unsigned int cell = 0; cell < net->cells; cell++) {
+        square s = board_get(b, make_pos(cell / net->side, cell % net->side));
+        if (s != EMPTY) {
+            note(a, cell, s, 1);
+        }
+    }
+}
+
+void nnue_acc_update(nnue_acc* a, unsigned int cell, square old,
+square new) {
+    if (old != EMPTY) {
+        note(a, cell, old, 0);
+    }
+    if (new != EMPTY) {
+        note(a, cell, new, 1);
+    }
+}
+
+void nnue_acc_copy(nnue_acc* dst, const nnue_acc* src) {
+    memcpy(dst->sums, src->sums, 2 * src->net->hidden * sizeof(int16_t));
+    memcpy(dst->changes, src->changes, src->pending * sizeof(uint16_t));
+    dst->pending = src->pending;
+}
+
+int nnue_score(nnue_acc* a, turn next) {
+    flush(a);
+    const int16_t* white = a->sums;
+    const int16_t* black = a->sums + a->net->hidden;
+    return (next == WHITE_NEXT) ? active->forward(a->net, white, black)
+                                : active->forward(a->net, black, white);
+}
+
+unsigned long nnue_dump(const char* path, unsigned int side, enum type type,
+unsigned long games, uint64_t seed, policy p) {
+    const char results[4] = {'d', 'w', 'b', 'd'};
+    FILE* f = fopen(path, "w");
+    game* g = new_game(side, type);
+    move* played = (move*)malloc(side * side * sizeof(move));
+    char* line = (char*)malloc((side * side) + 4);
+    unsigned long written = 0;
+    rng r;
+    if (f == NULL) {
+        fprintf(stderr, "nnue_dump: could not create %s.\n", path);
+        exit(1);
+    } else if (played == NULL || line == NULL) {
+        fprintf(stderr, "nnue_dump: malloc failed.\n");
+        exit(1);
+    }
+    rng_seed(&r, seed);
+    for (unsigned long i = 0; i < games; i++) {
+        game_reset(g);
+        unsigned int plies = sim_playout(g, &r, p, played);
+        char result = results[g->state];
+        game_reset(g); /* again from the start, writing as it goes */
+        for (unsigned int k = 0; k < plies; k++) {
+            game_to_string(g, line);
+            fprintf(f, "%s %c\n", line, result);
+            make_move(g, played[k]);
+        }
+        written += plies;
+    }
+    if (fclose(f) != 0) {
+        fprintf(stderr, "nnue_dump: could not write %s.\n", path);
+        exit(1);
+    }
+    free(line);
+    free(played);
+    game_free(g);
+    return written;
+}
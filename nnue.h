@@ -0,0 +1,83 @@
+#ifndef _NNUE_H
+#define _NNUE_H
+
+#include <stdint.h>
+#include "logic.h"
+#include "sim.h"
+
+/* a small quantised network scoring positions for the player to move.
+the first layer has one input per (cell, colour) seen from each side, so
+its sums (the accumulator) change by a weight row per marble moved, and
+are kept per game rather than recomputed. the two sums, the mover's first,
+are clipped to 0..127 and fed to a layer of int8 weights, clipped again
+and summed into the score.
+
+a network file holds, in native byte order, a 64 byte header (magic
+"PTNN", version, side, hidden, l1, shift) and then, each starting on a 64
+byte boundary: int16 first layer weights, one row of hidden per feature
+(the mover's colour on each cell, then the opponent's), int16 first layer
+biases, int8 second layer weights (l1 rows of 2 * hidden), int32 second
+layer biases, l1 int8 output weights and one int32 output bias. the
+second layer's sums are shifted right by shift before clipping */
+
+struct nnue;
+
+typedef struct nnue nnue;
+
+struct nnue_acc;
+
+typedef struct nnue_acc nnue_acc;
+
+/* maps the network file at path. returns NULL if it is missing or is not
+a network file */
+nnue* nnue_load(const char* path);
+
+/* unmaps a network. accumulators using it must be freed first */
+void nnue_unload(nnue* net);
+
+/* returns the board side net was made for */
+unsigned int nnue_side(const nnue* net);
+
+/* writes a network for inputted side with hidden first layer sums (a
+multiple of 32) and small weights drawn from seed, a starting point for
+offline training and a stand-in for benchmarks. returns 0, or -1 if the
+file could not be written */
+int nnue_write_random(const char* path, unsigned int side,
+                      unsigned int hidden, uint64_t seed);
+
+/* makes an accumulator for net, of an empty board */
+nnue_acc* nnue_acc_new(const nnue* net);
+
+/* frees an accumulator */
+void nnue_acc_free(nnue_acc* a);
+
+/* recomputes the accumulator from board b */
+void nnue_acc_refresh(nnue_acc* a, board* b);
+
+/* notes that cell went from old to new. the weight rows are only added
+when the next score is asked for, all pending changes in one pass, so the
+cells a twist moves cost one sweep over the accumulator together */
+void nnue_acc_update(nnue_acc* a, unsigned int cell, square old,
+                     square new);
+
+/* overwrites accumulator dst with src, both for the same network */
+void nnue_acc_copy(nnue_acc* dst, const nnue_acc* src);
+
+/* returns the network's score for the player next to move */
+int nnue_score(nnue_acc* a, turn next);
+
+/* returns the instruction set inference runs on, "avx2" or "scalar" */
+const char* nnue_isa(void);
+
+/* makes inference run on isa from now on. returns 0 and changes nothing
+if the processor cannot run it */
+int nnue_use(const char* isa);
+
+/* plays games games on boards of inputted side and type with both players
+following policy p, drawing from seed, and writes every position before
+the last move to path as a game_to_string line, a space and the game's
+result: w, b or d. returns the number of positions written */
+unsigned long nnue_dump(const char* path, unsigned int side, enum type type,
+                        unsigned long games, uint64_t seed, policy p);
+
+#endif /* _NNUE_H */
@@ -1,7 +1,27 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include "analyze.h"
+#include "dfpn.h"
+#include "eval.h"
 #include "logic.h"
+#include "mcts.h"
+#include "nnue.h"
+#include "protocol.h"
+#include "record.h"
+#include "server.h"
+#include "sim.h"
+#include "smp.h"
+#include "tablebase.h"
+
+/* where the game is recorded ("-record FILE"), or NULL, and the cell the
+player to move placed on before choosing a twist */
+static recorder* game_record = NULL;
+static unsigned int placed_cell = 0;
+
+/* whether the engine searches the expected reply while the human thinks
+("-ponder") */
+static int ponder = 0;
 
 /* helper function that scans user's inputted command-line arguments and
 updates the side and type out-parameters 
@@ -27,6 +47,14 @@ int find_side_type(int argc, char *argv[], unsigned int* side, enum type* t) {
             *t = BITS;
             count++;
             typ++;
+        } else if (strcmp(argv[i], "-m") == 0) {
+            *t = MASKS;
+            count++;
+            typ++;
+        } else if (strcmp(argv[i], "-l") == 0) {
+            *t = LARGE;
+            count++;
+            typ++;
         }
     }
     if (count != 2) {
@@ -38,6 +66,73 @@ int find_side_type(int argc, char *argv[], unsigned int* side, enum type* t) {
 }
 
 
+/* helper function that scans the command-line arguments for an engine
+opponent ("-ai w" or "-ai b", optionally "-depth N", "-time ms", "-hash MB",
+"-sym" and "-threads N"), updating the out-parameters. returns 1 if an
+engine plays, 0 otherwise */
+int find_engine(int argc, char *argv[], turn* engine, unsigned int* depth,
+unsigned int* ms, unsigned int* hash_mb, int* sym, unsigned int* threads) {
+    int found = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-ai") == 0) {
+            if ((i + 1 < argc) && (strcmp(argv[i + 1], "w") == 0)) {
+                *engine = WHITE_NEXT;
+            } else if ((i + 1 < argc) && (strcmp(argv[i + 1], "b") == 0)) {
+                *engine = BLACK_NEXT;
+            } else {
+                fprintf(stderr, "find_engine: -ai must be followed by w or "
+                "b.\n");
+                exit(1);
+            }
+            found = 1;
+        } else if ((strcmp(argv[i], "-depth") == 0) && (i + 1 < argc)) {
+            *depth = atoi(argv[i + 1]);
+        } else if ((strcmp(argv[i], "-time") == 0) && (i + 1 < argc)) {
+            *ms = atoi(argv[i + 1]);
+        } else if ((strcmp(argv[i], "-hash") == 0) && (i + 1 < argc)) {
+            *hash_mb = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-sym") == 0) {
+            *sym = 1;
+        } else if ((strcmp(argv[i], "-threads") == 0) && (i + 1 < argc)) {
+            *threads = atoi(argv[i + 1]);
+            if (*threads < 1) {
+                fprintf(stderr, "find_engine: -threads must be at least "
+                "one.\n");
+                exit(1);
+            }
+        }
+    }
+    return found;
+}
+
+/* helper function that scans the command-line arguments for "-engine mcts"
+(Monte Carlo tree search instead of alpha-beta), "-playouts N" and
+"-batch K", updating the out-parameters. returns 1 if MCTS is chosen */
+int find_mcts(int argc, char *argv[], unsigned long* playouts,
+unsigned int* batch) {
+    int found = 0;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-engine") == 0) {
+            if (strcmp(argv[i + 1], "mcts") == 0) {
+                found = 1;
+            } else if (strcmp(argv[i + 1], "ab") != 0) {
+                fprintf(stderr, "find_mcts: -engine must be followed by ab "
+                "or mcts.\n");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-playouts") == 0) {
+            *playouts = strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-batch") == 0) {
+            *batch = atoi(argv[i + 1]);
+            if (*batch < 1) {
+                fprintf(stderr, "find_mcts: -batch must be at least one.\n");
+                exit(1);
+            }
+        }
+    }
+    return found;
+}
+
 /* helper function that creates the game using user-inputted side and type */
 game* create_game(int argc, char *argv[]) {
     unsigned int side = 0;
@@ -90,6 +185,7 @@ unsigned int valid_marble_input(game* g) {
         printf("Position already occupied.\n");
     } else {
         place_marble(g, make_pos((unsigned int)r, (unsigned int)c));
+        placed_cell = ((unsigned int)r * g->b->side) + (unsigned int)c;
         return 1;
     }
     return 0;
@@ -124,26 +220,47 @@ unsigned int prompt_twist(game* g) {
         printf("Please enter a valid input with no spaces (e.g. NW0).\n");
         return 0;
     }
+    quadrant q;
     if ((s[0] == 'N') && (s[1] == 'W')) {
-        twist_quadrant(g, NW, d);
+        q = NW;
     } else if ((s[0] == 'N') && (s[1] == 'E')) {
-        twist_quadrant(g, NE, d);
+        q = NE;
     } else if ((s[0] == 'S') && (s[1] == 'W')) {
-        twist_quadrant(g, SW, d);
+        q = SW;
     } else if ((s[0] == 'S') && (s[1] == 'E')) {
-        twist_quadrant(g, SE, d);
+        q = SE;
     } else {
         printf("Please enter a valid input with no spaces (e.g. NW0).\n");
         return 0;
     }
+    twist_quadrant(g, q, d);
+    if (game_record != NULL) {
+        record_move(game_record, MOVE(placed_cell, q, d));
+    }
     return 1;
 }
 
+/* helper function that ends the recording, if any, of the finished game g.
+i is 0 when the placement won, so the move has not been recorded yet */
+void finish_record(game* g, unsigned int i) {
+    if (game_record != NULL) {
+        if (!i) { /* the twist is never played, any will do */
+            record_move(game_record, MOVE(placed_cell, NW, CW));
+        }
+        record_end(game_record, g->state);
+        record_close(game_record);
+        game_record = NULL;
+    }
+}
+
 /* helper function called before and after twist to see check if game is over.
 variable i used to keep track whether function call is before or after twist
 i is 0 before twist and 1 after twist */
 void check_game_state(game* g, unsigned int i) {
     if (game_over(g)) {
+        if ((game_outcome(g) != DRAW) || i) { /* the game is over */
+            finish_record(g, i);
+        }
         if ((game_outcome(g) == DRAW) && i) { /* DRAW and after twist */
             printf("Game over. Draw.\n");
                 board_show(g->b);
@@ -172,13 +289,390 @@ void check_game_state(game* g, unsigned int i) {
     }
 }
 
+/* helper function that prints a move the way a player would type it: row,
+column, then quadrant and twist direction */
+void print_move(game* g, move m) {
+    const char* names[4] = {"NW", "NE", "SW", "SE"};
+    unsigned int cell = MOVE_CELL(m), side = g->b->side;
+    printf("%c %c %s%c", get_label(cell / side), get_label(cell % side),
+           names[MOVE_QUADRANT(m)], (MOVE_DIRECTION(m) == CW) ? '1' : '0');
+}
+
+/* helper function that lets the engine search for and play its move, then
+reports the move along with search depth, throughput and table use. with
+pondering, a background search of the reply it expected has been running
+since its last move: if the human played it that search goes on to the
+time limit, counted from its start, otherwise it is dropped and a new one
+starts from the table it filled. then the next reply is pondered, if the
+search expected one */
+void engine_turn(game* g, smp* s, tt* t, unsigned int depth,
+unsigned int ms) {
+    search_result res;
+    if (smp_ponder_hit(s, g)) {
+        res = smp_ponder_stop(s, ms);
+        printf("ponder hit\n");
+    } else {
+        smp_ponder_stop(s, 0);
+        res = smp_run(s, g, depth, ms);
+    }
+    printf("%s (engine): ", (g->next == WHITE_NEXT) ? "White" : "Black");
+    print_move(g, res.best);
+    printf("\ndepth %u, score %d, %lu nodes in %.2fs (%.0f nodes/sec)\n",
+           res.depth, res.score, res.nodes, res.seconds,
+           (res.seconds > 0) ? res.nodes / res.seconds : 0.0);
+    printf("table: %.1f%% hits of %lu probes, %zu MB\n",
+           res.tt_probes ? (100.0 * res.tt_hits) / res.tt_probes : 0.0,
+           res.tt_probes, tt_bytes(t) >> 20);
+    if (game_record != NULL) {
+        record_move(game_record, res.best);
+    }
+    make_move(g, res.best);
+    check_game_state(g, 1); /* exits if the move ended the game */
+    if (ponder && res.ponder != MOVE_NONE) { /* else nothing to expect */
+        smp_ponder(s, g, res.ponder, depth);
+    }
+}
+
+/* helper function that lets the tree search play its move, then reports
+the move with its playout count, playouts/sec and tree size */
+void mcts_turn(game* g, mcts* m, unsigned long playouts, unsigned int ms) {
+    mcts_result res = mcts_run(m, g, playouts, ms);
+    printf("%s (engine): ", (g->next == WHITE_NEXT) ? "White" : "Black");
+    print_move(g, res.best);
+    printf("\n%lu playouts in %.2fs (%.0f playouts/sec), value %.3f over "
+           "%lu visits\n", res.playouts, res.seconds,
+           (res.seconds > 0) ? res.playouts / res.seconds : 0.0, res.value,
+           res.visits);
+    printf("tree: %lu nodes, %lu kept from the last move\n", res.nodes,
+           res.reused);
+    if (game_record != NULL) {
+        record_move(game_record, res.best);
+    }
+    make_move(g, res.best);
+    check_game_state(g, 1); /* exits if the move ended the game */
+}
+
+/* helper function that plays the perfect move from the 4x4 tablebase and
+reports the value it keeps */
+void tablebase_turn(game* g, tablebase* tb) {
+    const char* values[3] = {"loss", "draw", "win"};
+    tb_entry e;
+    move m = tablebase_best(tb, g, &e);
+    printf("%s (engine): ", (g->next == WHITE_NEXT) ? "White" : "Black");
+    print_move(g, m);
+    printf("\ntablebase: %s in %u plies\n", values[e.value], e.dte);
+    if (game_record != NULL) {
+        record_move(game_record, m);
+    }
+    make_move(g, m);
+    check_game_state(g, 1); /* exits if the move ended the game */
+}
+
+/* helper function for headless self-play: plays games random games
+("-policy greedy" to take immediate wins, "-seed S" to vary them,
+"-record FILE" to keep them) on the side and type of g across threads
+threads and prints the statistics */
+void simulate(game* g, int argc, char *argv[], unsigned long games,
+unsigned int threads) {
+    policy p = RANDOM;
+    uint64_t seed = 1;
+    recorder* rec = NULL;
+    sim_stats st;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-policy") == 0) {
+            p = (strcmp(argv[i + 1], "greedy") == 0) ? GREEDY : RANDOM;
+        } else if (strcmp(argv[i], "-seed") == 0) {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-record") == 0) {
+            rec = record_create(argv[i + 1], g->b->side, g->b->type);
+        }
+    }
+    sim_run(g->b->side, g->b->type, games, threads, seed, p, rec, &st);
+    if (rec != NULL) {
+        record_close(rec);
+    }
+    sim_report(&st);
+    sim_stats_free(&st);
+    game_free(g);
+}
+
+/* helper function that replays the games recorded in path on the type of
+g ("-verify" to check every move and outcome, "-positions OUT" to write
+each position reached to OUT) and prints the totals */
+void replay(game* g, int argc, char *argv[], const char* path) {
+    int verify = 0;
+    FILE* positions = NULL;
+    replay_stats st;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-verify") == 0) {
+            verify = 1;
+        } else if ((strcmp(argv[i], "-positions") == 0) && (i + 1 < argc)) {
+            positions = fopen(argv[i + 1], "w");
+            if (positions == NULL) {
+                fprintf(stderr, "replay: could not create %s.\n",
+                        argv[i + 1]);
+                exit(1);
+            }
+        }
+    }
+    record_file* f = record_map(path);
+    if (f == NULL) {
+        fprintf(stderr, "replay: no game record at %s.\n", path);
+        exit(1);
+    }
+    record_replay(f, g->b->type, verify, positions, &st);
+    replay_report(&st);
+    if (positions != NULL) {
+        fclose(positions);
+    }
+    record_unmap(f);
+    game_free(g);
+}
+
+/* helper function that serves games of the side and type of g on the
+socket at path, or with load puts the server there under load instead
+("-sessions N" connections, at most or at once, "-moves M" in all and
+"-seed S" to vary them) */
+void serve(game* g, int argc, char *argv[], const char* path, int load) {
+    unsigned int sessions = load ? 1000 : 4096;
+    unsigned long moves = 1000000;
+    uint64_t seed = 1;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-sessions") == 0) {
+            sessions = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-moves") == 0) {
+            moves = strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-seed") == 0) {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        }
+    }
+    if (sessions == 0) {
+        fprintf(stderr, "serve: -sessions must be at least 1.\n");
+        exit(1);
+    } else if (load) {
+        server_load(path, g->b->side, g->b->type, sessions, moves, seed);
+    } else {
+        server_run(path, g->b->side, g->b->type, sessions);
+    }
+    game_free(g);
+}
+
+/* helper function that analyses the positions, one per line, of the file
+at path ("-" for standard input) on boards of the side and type of g, and
+writes a result per line to standard output. searches go "-depth N" plies
+(4 unless given) and, with "-time ms", stop after that long per position.
+every worker has a table of "-hash MB", 1 unless given, cleared for each
+position so a small one is quicker */
+void analyze(game* g, int argc, char *argv[], const char* path,
+             unsigned int depth, unsigned int threads) {
+    analyze_options opts = {threads, (depth < 64) ? depth : 4, 0, 1};
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-time") == 0) {
+            opts.movetime_ms = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-hash") == 0) {
+            opts.hash_mb = atoi(argv[i + 1]);
+        }
+    }
+    FILE* in = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "analyze: could not open %s.\n", path);
+        exit(1);
+    }
+    analyze_run(in, stdout, g->b->side, g->b->type, &opts);
+    if (in != stdin) {
+        fclose(in);
+    }
+    game_free(g);
+}
+
+/* helper function that proves the value of position (as game_to_string
+writes it, or "start") on a game of the side and type of g, with a proof
+table of hash_mb MB. "-checkpoint FILE" saves the proof every
+"-every S" seconds (600 by default) and resumes it, "-nodes N" stops after
+N nodes and "-report S" prints progress every S seconds (10 by default) */
+void prove(game* g, int argc, char *argv[], const char* position,
+           unsigned int hash_mb) {
+    dfpn_options opts = {hash_mb, NULL, 600, 10, 0};
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-checkpoint") == 0) {
+            opts.checkpoint = argv[i + 1];
+        } else if (strcmp(argv[i], "-every") == 0) {
+            opts.checkpoint_s = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-nodes") == 0) {
+            opts.max_nodes = strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-report") == 0) {
+            opts.report_s = atoi(argv[i + 1]);
+        }
+    }
+    if (strcmp(position, "start") != 0
+        && game_from_string(g, position) != 0) {
+        fprintf(stderr, "prove: not a position of side %u.\n", g->b->side);
+        exit(1);
+    }
+    const char* values[4] = {"unknown", "win", "loss", "draw"};
+    dfpn_result res = dfpn_solve(g, &opts);
+    char best[16] = "none";
+    if (res.best != MOVE_NONE) {
+        move_format(res.best, g->b->side, best);
+    }
+    printf("prove value=%s best=%s nodes=%lu proven=%lu seconds=%.1f\n",
+           values[res.value], best, res.nodes, res.proven, res.seconds);
+    game_free(g);
+}
+
+/* helper function that loads the network named by "-nnue FILE", if any,
+for the engine to score positions with. returns it, or NULL */
+nnue* find_network(game* g, int argc, char *argv[]) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-nnue") == 0) {
+            nnue* net = nnue_load(argv[i + 1]);
+            if (net == NULL) {
+                fprintf(stderr, "main: no network at %s.\n", argv[i + 1]);
+                exit(1);
+            } else if (nnue_side(net) != g->b->side) {
+                fprintf(stderr, "main: %s is for side %u.\n", argv[i + 1],
+                        nnue_side(net));
+                exit(1);
+            }
+            eval_use_network(net);
+            return net;
+        }
+    }
+    return NULL;
+}
+
+/* helper function for the network tools: "-nnue-init FILE" writes a
+random network for the side of g ("-hidden N" first layer sums, 64 by
+default), "-dump FILE" writes labelled positions from "-games N" self-play
+games ("-seed S" and "-policy greedy" as for -simulate). returns 1 if one
+of them ran */
+int network_tools(game* g, int argc, char *argv[]) {
+    unsigned int hidden = 64;
+    unsigned long games = 1000;
+    uint64_t seed = 1;
+    policy p = RANDOM;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-hidden") == 0) {
+            hidden = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-games") == 0) {
+            games = strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-seed") == 0) {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-policy") == 0) {
+            p = (strcmp(argv[i + 1], "greedy") == 0) ? GREEDY : RANDOM;
+        }
+    }
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-nnue-init") == 0) {
+            if (hidden == 0 || hidden % 32 != 0 || hidden > 512) {
+                fprintf(stderr, "main: -hidden must be a multiple of 32 "
+                        "up to 512.\n");
+                exit(1);
+            } else if (nnue_write_random(argv[i + 1], g->b->side, hidden,
+                                         seed) != 0) {
+                fprintf(stderr, "main: could not write %s.\n", argv[i + 1]);
+                exit(1);
+            }
+            return 1;
+        } else if (strcmp(argv[i], "-dump") == 0) {
+            unsigned long n = nnue_dump(argv[i + 1], g->b->side, g->b->type,
+                                        games, seed, p);
+            printf("dump games=%lu positions=%lu\n", games, n);
+            return 1;
+        }
+    }
+    return 0;
+}
+
 /* main function that is run, uses helper functions defined above to run
 the game, exits when game is over */
 int main(int argc, char *argv[]) {
     game* g = create_game(argc, argv);
+    turn engine = BLACK_NEXT;
+    unsigned int depth = 64, ms = 2000, hash_mb = 64, threads = 1;
+    int sym = 0; /* engine options */
+    int ai = find_engine(argc, argv, &engine, &depth, &ms, &hash_mb, &sym,
+                         &threads);
+    if (network_tools(g, argc, argv)) {
+        game_free(g);
+        return 0;
+    }
+    find_network(g, argc, argv); /* kept until the process ends */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-scaling") == 0) { /* report, then quit */
+            smp_scaling(g->b->side, g->b->type, threads,
+                        (depth < 64) ? depth : 4, hash_mb);
+            game_free(g);
+            return 0;
+        } else if (strcmp(argv[i], "-protocol") == 0) {
+            protocol_options opts = {threads, hash_mb, sym};
+            protocol_run(stdin, stdout, g->b->side, g->b->type, &opts);
+            game_free(g);
+            return 0;
+        } else if ((strcmp(argv[i], "-solve") == 0) && (i + 1 < argc)) {
+            tablebase_solve(argv[i + 1], threads);
+            game_free(g);
+            return 0;
+        } else if ((strcmp(argv[i], "-simulate") == 0) && (i + 1 < argc)) {
+            simulate(g, argc, argv, strtoul(argv[i + 1], NULL, 10), threads);
+            return 0;
+        } else if ((strcmp(argv[i], "-replay") == 0) && (i + 1 < argc)) {
+            replay(g, argc, argv, argv[i + 1]);
+            return 0;
+        } else if ((strcmp(argv[i], "-serve") == 0) && (i + 1 < argc)) {
+            serve(g, argc, argv, argv[i + 1], 0);
+            return 0;
+        } else if ((strcmp(argv[i], "-loadgen") == 0) && (i + 1 < argc)) {
+            serve(g, argc, argv, argv[i + 1], 1);
+            return 0;
+        } else if ((strcmp(argv[i], "-analyze") == 0) && (i + 1 < argc)) {
+            analyze(g, argc, argv, argv[i + 1], depth, threads);
+            return 0;
+        } else if ((strcmp(argv[i], "-prove") == 0) && (i + 1 < argc)) {
+            prove(g, argc, argv, argv[i + 1], hash_mb);
+            return 0;
+        }
+    }
+    unsigned long playouts = 0;
+    unsigned int batch = 1;
+    int tree = ai && find_mcts(argc, argv, &playouts, &batch);
+    tt* t = (ai && !tree) ? tt_new(hash_mb) : NULL;
+    smp* s = (ai && !tree) ? smp_new(g->b->side, g->b->type, threads, t, sym)
+                           : NULL;
+    mcts* m = tree ? mcts_new(g->b->side, g->b->type, threads, hash_mb, batch)
+                   : NULL;
+    tablebase* tb = NULL;
+    for (int i = 1; ai && i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-tb") == 0) {
+            tb = (g->b->side == 4) ? tablebase_open(argv[i + 1]) : NULL;
+            if (tb == NULL) {
+                fprintf(stderr, "main: no 4x4 tablebase at %s.\n",
+                        argv[i + 1]);
+                exit(1);
+            }
+        }
+    }
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-record") == 0) {
+            game_record = record_create(argv[i + 1], g->b->side, g->b->type);
+        }
+    }
+    for (int i = 1; i < argc; i++) {
+        ponder = ponder || strcmp(argv[i], "-ponder") == 0;
+    }
     printf("Welcome to the game!\nThe current board state is:\n");
     while (1) { /* run loop until game exits by itself */
         board_show(g->b); /* draw state of the board*/
+        if (tb != NULL && (g->next == engine)) {
+            tablebase_turn(g, tb);
+            continue;
+        } else if (tree && (g->next == engine)) {
+            mcts_turn(g, m, playouts, ms);
+            continue;
+        } else if (ai && (g->next == engine)) {
+            engine_turn(g, s, t, depth, ms);
+            continue;
+        }
         unsigned int i = 0;
         while (!i) { /* prompts user to input until valid and marble placed */
             i = valid_marble_input(g);
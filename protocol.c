@@ -0,0 +1,233 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "eval.h"
+#include "protocol.h"
+#include "smp.h"
+
+/* everything a session keeps between commands */
+struct session {
+    FILE* out;
+    game* g;
+    tt* table;
+    smp* engine;
+    move* buffer;        /* perft room, grown to the deepest request */
+    unsigned int buffer_depth;
+};
+
+static const char* quadrant_names[4] = {"NW", "NE", "SW", "SE"};
+
+/* helper function that returns the row or column a label stands for, the
+inverse of get_label, or -1 if c is not a label */
+static int label_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'A' && c <= 'Z') {
+        return c - 'A' + 10;
+    } else if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 36;
+    }
+    return -1;
+}
+
+void move_format(move m, unsigned int side, char* out) {
+    unsigned int cell = MOVE_CELL(m);
+    out[0] = get_label(cell / side);
+    out[1] = get_label(cell % side);
+    memcpy(out + 2, quadrant_names[MOVE_QUADRANT(m)], 2);
+    out[4] = (MOVE_DIRECTION(m) == CW) ? '1' : '0';
+    out[5] = '\0';
+}
+
+int move_parse(const char* text, unsigned int side, move* m) {
+    int r = label_value(text[0]), c = (r < 0) ? -1 : label_value(text[1]);
+    if (r < 0 || c < 0 || (unsigned int)r >= side || (unsigned int)c >= side
+        || strlen(text) != 5 || (text[4] != '0' && text[4] != '1')) {
+        return 0;
+    }
+    for (unsigned int q = 0; q < 4; q++) {
+        if (strncmp(text + 2, quadrant_names[q], 2) == 0) {
+            *m = MOVE(((unsigned int)r * side) + (unsigned int)c, q,
+                      (text[4] == '1') ? CW : CCW);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* helper function that returns monotonic time in seconds */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/* helper function that plays the moves named by the rest of the line
+(strtok state), stopping at the first that is malformed or illegal.
+returns 1 if it answered with an error */
+static int play_moves(struct session* s) {
+    unsigned int side = s->g->b->side;
+    char* tok;
+    while ((tok = strtok(NULL, " \t\r\n")) != NULL) {
+        move m;
+        if (!move_parse(tok, side, &m) || s->g->state != 0
+            || board_get(s->g->b, make_pos(MOVE_CELL(m) / side,
+                                           MOVE_CELL(m) % side)) != EMPTY) {
+            fprintf(s->out, "error illegal move %s\n", tok);
+            return 1;
+        }
+        make_move(s->g, m);
+    }
+    return 0;
+}
+
+/* helper function that reads text as a plain decimal number into value.
+returns 0 if it is anything else, a sign or garbage included */
+static int parse_number(const char* text, unsigned long* value) {
+    char* end;
+    if (*text < '0' || *text > '9') {
+        return 0;
+    }
+    *value = strtoul(text, &end, 10);
+    return *end == '\0';
+}
+
+/* helper function for "go": searches the current position and answers
+with the search statistics and the move, or with an error if a depth or
+time is not a number or the depth is 0 */
+static void go(struct session* s) {
+    unsigned long depth = 64, ms = 0;
+    char* tok;
+    while ((tok = strtok(NULL, " \t\r\n")) != NULL) {
+        char* value = strtok(NULL, " \t\r\n");
+        if (value == NULL) {
+            break;
+        } else if (strcmp(tok, "depth") == 0) {
+            if (!parse_number(value, &depth) || depth == 0
+                || depth > UINT_MAX) {
+                fprintf(s->out, "error bad go depth %s\n", value);
+                return;
+            }
+        } else if (strcmp(tok, "movetime") == 0) {
+            if (!parse_number(value, &ms) || ms > UINT_MAX) {
+                fprintf(s->out, "error bad go movetime %s\n", value);
+                return;
+            }
+        }
+    }
+    if (s->g->state != 0) {
+        fprintf(s->out, "bestmove none\n");
+        return;
+    }
+    search_result res = smp_run(s->engine, s->g, (unsigned int)depth,
+                                (unsigned int)ms);
+    char text[6];
+    move_format(res.best, s->g->b->side, text);
+    fprintf(s->out, "info depth %u score %d nodes %lu nps %.0f time %.0f\n"
+            "bestmove %s\n", res.depth, res.score, res.nodes,
+            (res.seconds > 0) ? res.nodes / res.seconds : 0.0,
+            res.seconds * 1000, text);
+}
+
+/* helper function for "perft": counts and times the positions depth plies
+ahead of the current one, depth given as text (1 if NULL). a depth that is
+not a number or goes past the cells left empty is answered with an error */
+static void run_perft(struct session* s, const char* text) {
+    unsigned int empty = s->g->b->side * s->g->b->side - s->g->filled;
+    unsigned long depth = 1;
+    if (text != NULL) {
+        if (!parse_number(text, &depth) || depth > empty) {
+            fprintf(s->out, "error bad perft depth %s\n", text);
+            return;
+        }
+    }
+    if (depth > s->buffer_depth) {
+        free(s->buffer);
+        s->buffer = (move*)malloc(depth * MAX_MOVES(s->g->b->side)
+                                  * sizeof(move));
+        if (s->buffer == NULL) {
+            fprintf(stderr, "protocol_run: malloc failed.\n");
+            exit(1);
+        }
+        s->buffer_depth = depth;
+    }
+    double start = now_seconds();
+    unsigned long nodes = perft(s->g, depth, s->buffer);
+    double seconds = now_seconds() - start;
+    fprintf(s->out, "perft depth %lu nodes %lu time %.0f\n", depth, nodes,
+            seconds * 1000);
+}
+
+/* helper function for "eval": the static score for the player to move and
+whether the game is over */
+static void evaluate(struct session* s) {
+    const char* states[4] = {"none", "white", "black", "draw"};
+    fprintf(s->out, "eval %d %s winner %s\n", eval_score(s->g),
+            (s->g->next == WHITE_NEXT) ? "white" : "black",
+            states[s->g->state]);
+}
+
+void protocol_run(FILE* in, FILE* out, unsigned int side, enum type type,
+protocol_options* opts) {
+    struct session s;
+    s.out = out;
+    s.g = new_game(side, type);
+    eval_attach(s.g);
+    s.table = tt_new(opts->hash_mb);
+    s.engine = smp_new(side, type, opts->threads, s.table, opts->sym);
+    s.buffer = NULL;
+    s.buffer_depth = 0;
+    setvbuf(out, NULL, _IOFBF, 1 << 16); /* written out once per answer */
+    char* line = NULL;
+    size_t cap = 0;
+    while (getline(&line, &cap, in) != -1) {
+        char* cmd = strtok(line, " \t\r\n");
+        int wrote = 1; /* most commands answer */
+        if (cmd == NULL) {
+            continue;
+        } else if (strcmp(cmd, "quit") == 0) {
+            break;
+        } else if (strcmp(cmd, "isready") == 0) {
+            fprintf(out, "readyok\n");
+        } else if (strcmp(cmd, "newgame") == 0) {
+            game_reset(s.g);
+            tt_clear(s.table);
+            wrote = 0;
+        } else if (strcmp(cmd, "position") == 0) {
+            char* what = strtok(NULL, " \t\r\n");
+            if (what == NULL || strcmp(what, "startpos") != 0) {
+                fprintf(out, "error position needs startpos\n");
+            } else {
+                game_reset(s.g);
+                what = strtok(NULL, " \t\r\n");
+                wrote = (what != NULL && strcmp(what, "moves") == 0)
+                      ? play_moves(&s) : 0;
+            }
+        } else if (strcmp(cmd, "moves") == 0) {
+            wrote = play_moves(&s);
+        } else if (strcmp(cmd, "go") == 0) {
+            go(&s);
+        } else if (strcmp(cmd, "perft") == 0) {
+            char* depth = strtok(NULL, " \t\r\n");
+            run_perft(&s, depth);
+        } else if (strcmp(cmd, "eval") == 0) {
+            evaluate(&s);
+        } else if (strcmp(cmd, "show") == 0) {
+            fflush(out); /* board_show writes to stdout */
+            board_show(s.g->b);
+            fflush(stdout);
+        } else {
+            fprintf(out, "error unknown command %s\n", cmd);
+        }
+        if (wrote) { /* silent commands leave the buffer for the next */
+            fflush(out);
+        }
+    }
+    fflush(out);
+    free(line);
+    free(s.buffer);
+    smp_free(s.engine);
+    tt_free(s.table);
+    game_free(s.g);
+}
@@ -0,0 +1,44 @@
+#ifndef _PROTOCOL_H
+#define _PROTOCOL_H
+
+#include <stdio.h>
+#include "logic.h"
+
+/* engine settings for a protocol session */
+struct protocol_options {
+    unsigned int threads;
+    unsigned int hash_mb;
+    int sym;               /* symmetric positions share table entries */
+};
+
+typedef struct protocol_options protocol_options;
+
+/* writes move m in the protocol's one-token form: row and column labels,
+then the quadrant and 1 for clockwise or 0 for counter-clockwise, as in
+"23NE0" */
+void move_format(move m, unsigned int side, char* out);
+
+/* reads a move in the form move_format writes. returns 1 and stores it in
+m if text is one, 0 otherwise. does not check that it is legal */
+int move_parse(const char* text, unsigned int side, move* m);
+
+/* answers commands read line by line from in on out until "quit" or the
+end of input, for games of inputted side and type. output is buffered and
+flushed once per answer, and nothing is drawn unless asked with "show".
+commands:
+  isready                      answers readyok
+  newgame                      empty board, cleared table
+  position startpos [moves M...]  sets the position, then plays moves
+  moves M...                   plays moves from the current position
+  go [depth N] [movetime MS]   searches, answers info then bestmove, N at
+                               least 1
+  perft N                      counts the positions N plies ahead, N no
+                               more than the cells left empty
+  eval                         static score for the player to move
+  show                         draws the board
+  quit                         ends the session
+anything else is answered with a line starting "error" */
+void protocol_run(FILE* in, FILE* out, unsigned int side, enum type type,
+                  protocol_options* opts);
+
+#endif /* _PROTOCOL_H */
@@ -0,0 +1,279 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "record.h"
+
+static const char record_magic[4] = {'P', 'T', 'G', 'R'};
+
+#define RECORD_VERSION 1
+
+/* largest side whose move numbers, MAX_MOVES(side) - 1, and the four end
+codes fit in two bytes */
+#define RECORD_MAX_SIDE 90
+
+/* file header, the games start right after it */
+struct record_header {
+    char magic[4];
+    uint8_t version;
+    uint8_t side;
+    uint8_t type;
+    uint8_t width;   /* bytes per move and end code, 1 or 2 */
+};
+
+struct recorder {
+    FILE* f;
+    unsigned int width;
+    unsigned int end;     /* code of an unfinished game end, states follow */
+    unsigned char* pending; /* the game record_move is streaming */
+    unsigned int used;
+    unsigned char* scratch; /* record_game's encoding room, under lock */
+    pthread_mutex_t lock;
+};
+
+struct record_file {
+    const unsigned char* map;
+    size_t bytes;
+    unsigned int side;
+    unsigned int width;
+    unsigned int end;
+};
+
+/* helper function that returns the bytes per code for a side: one when
+every move number and the four end codes fit in a byte */
+static unsigned int code_width(unsigned int side) {
+    return (MAX_MOVES(side) <= 0xFF - 3) ? 1 : 2;
+}
+
+/* helper function that stores code in width bytes at out, low byte first,
+and returns how many it wrote */
+static unsigned int put_code(unsigned char* out, unsigned int code,
+unsigned int width) {
+    out[0] = (unsigned char)code;
+    if (width == 2) {
+        out[1] = (unsigned char)(code >> 8);
+    }
+    return width;
+}
+
+/* helper function that writes len encoded bytes as one piece */
+static void write_game(recorder* r, const unsigned char* bytes, size_t len) {
+    pthread_mutex_lock(&r->lock);
+    if (fwrite(bytes, 1, len, r->f) != len) {
+        fprintf(stderr, "record_end: could not write the record.\n");
+        exit(1);
+    }
+    pthread_mutex_unlock(&r->lock);
+}
+
+recorder* record_create(const char* path, unsigned int side, enum type type) {
+    if (side > RECORD_MAX_SIDE) {
+        fprintf(stderr, "record_create: side must be at most %d.\n",
+                RECORD_MAX_SIDE);
+        exit(1);
+    }
+    recorder* r = (recorder*)malloc(sizeof(recorder));
+    if (r == NULL) {
+        fprintf(stderr, "record_create: malloc failed.\n");
+        exit(1);
+    }
+    r->width = code_width(side);
+    r->end = ((r->width == 1) ? 0xFF : 0xFFFF) - 3;
+    /* a game has at most one move per cell, then its end code */
+    r->pending = (unsigned char*)malloc((side * side + 1) * r->width);
+    r->scratch = (unsigned char*)malloc((side * side + 1) * r->width);
+    r->used = 0;
+    r->f = fopen(path, "wb");
+    if (r->pending == NULL || r->scratch == NULL) {
+        fprintf(stderr, "record_create: malloc failed.\n");
+        exit(1);
+    } else if (r->f == NULL) {
+        fprintf(stderr, "record_create: could not create %s.\n", path);
+        exit(1);
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    struct record_header h;
+    memcpy(h.magic, record_magic, sizeof(h.magic));
+    h.version = RECORD_VERSION;
+    h.side = (uint8_t)side;
+    h.type = (uint8_t)type;
+    h.width = (uint8_t)r->width;
+    if (fwrite(&h, sizeof(h), 1, r->f) != 1) {
+        fprintf(stderr, "record_create: could not write %s.\n", path);
+        exit(1);
+    }
+    return r;
+}
+
+void record_move(recorder* r, move m) {
+    r->used += put_code(r->pending + r->used, m, r->width);
+}
+
+void record_end(recorder* r, int state) {
+    r->used += put_code(r->pending + r->used, r->end + state, r->width);
+    write_game(r, r->pending, r->used);
+    r->used = 0;
+}
+
+void record_game(recorder* r, const move* moves, unsigned int n, int state) {
+    unsigned int w = r->width;
+    pthread_mutex_lock(&r->lock);
+    unsigned char* out = r->scratch;
+    if (w == 1) { /* the common 4x4 case, one byte per move */
+        for (unsigned int i = 0; i < n; i++) {
+            out[i] = (unsigned char)moves[i];
+        }
+        out += n;
+    } else {
+        for (unsigned int i = 0; i < n; i++) {
+            out += put_code(out, moves[i], w);
+        }
+    }
+    out += put_code(out, r->end + state, w);
+    size_t len = out - r->scratch;
+    if (fwrite(r->scratch, 1, len, r->f) != len) {
+        fprintf(stderr, "record_game: could not write the record.\n");
+        exit(1);
+    }
+    pthread_mutex_unlock(&r->lock);
+}
+
+void record_close(recorder* r) {
+    if (fclose(r->f) != 0) {
+        fprintf(stderr, "record_close: could not write the record.\n");
+        exit(1);
+    }
+    pthread_mutex_destroy(&r->lock);
+    free(r->pending);
+    free(r->scratch);
+    free(r);
+}
+
+record_file* record_map(const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0
+        || (size_t)st.st_size < sizeof(struct record_header)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); /* the mapping stays valid */
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    const struct record_header* h = (const struct record_header*)map;
+    if (memcmp(h->magic, record_magic, sizeof(h->magic)) != 0
+        || h->version != RECORD_VERSION || h->side > RECORD_MAX_SIDE
+        || board_invalid(h->side, (enum type)h->type) != NULL
+        || h->width != code_width(h->side)) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    record_file* f = (record_file*)malloc(sizeof(record_file));
+    if (f == NULL) {
+        fprintf(stderr, "record_map: malloc failed.\n");
+        exit(1);
+    }
+    f->map = (const unsigned char*)map;
+    f->bytes = st.st_size;
+    f->side = h->side;
+    f->width = h->width;
+    f->end = ((f->width == 1) ? 0xFF : 0xFFFF) - 3;
+    return f;
+}
+
+void record_unmap(record_file* f) {
+    munmap((void*)f->map, f->bytes);
+    free(f);
+}
+
+unsigned int record_side(const record_file* f) {
+    return f->side;
+}
+
+/* helper function that returns monotonic time in seconds */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+void record_replay(const record_file* f, enum type type, int verify,
+FILE* positions, replay_stats* st) {
+    unsigned int side = f->side, w = f->width, moves = MAX_MOVES(side);
+    const unsigned char* p = f->map + sizeof(struct record_header);
+    const unsigned char* end = f->map + f->bytes;
+    game* g = new_game(side, type);
+    char* line = (char*)malloc(side * side + 4);
+    if (line == NULL) {
+        fprintf(stderr, "record_replay: malloc failed.\n");
+        exit(1);
+    }
+    memset(st, 0, sizeof(replay_stats));
+    double start = now_seconds();
+    while (p < end) {
+        int bad = 0, state = -1;
+        game_reset(g);
+        while (p + w <= end) {
+            unsigned int code = (w == 1) ? p[0] : p[0] | (p[1] << 8);
+            p += w;
+            if (code >= f->end) {
+                state = (int)(code - f->end);
+                break;
+            } else if (bad) {
+                continue; /* skip to the end of a rejected game */
+            }
+            unsigned int cell = MOVE_CELL(code);
+            /* out of range codes are never played, verified or not */
+            if (code >= moves || (verify && (g->state != 0
+                || board_get(g->b, make_pos(cell / side, cell % side))
+                   != EMPTY))) {
+                bad = 1;
+                continue;
+            }
+            make_move(g, (move)code);
+            st->moves++;
+            if (positions != NULL) {
+                game_to_string(g, line);
+                fputs(line, positions);
+                fputc('\n', positions);
+                st->positions++;
+            }
+        }
+        if (state < 0) {
+            p = end; /* cut off, a trailing partial code included */
+        }
+        st->games++;
+        if (bad || state < 0 || (verify && g->state != state)) {
+            st->bad++; /* rejected, cut off, or a different outcome */
+        } else if (state == 1) {
+            st->white++;
+        } else if (state == 2) {
+            st->black++;
+        } else if (state == 3) {
+            st->draws++;
+        } else {
+            st->unfinished++;
+        }
+    }
+    st->seconds = now_seconds() - start;
+    free(line);
+    game_free(g);
+}
+
+void replay_report(replay_stats* st) {
+    printf("replay games=%lu moves=%lu seconds=%.3f moves/s=%.0f\n",
+           st->games, st->moves, st->seconds,
+           (st->seconds > 0) ? st->moves / st->seconds : 0.0);
+    printf("outcomes white=%lu black=%lu draw=%lu unfinished=%lu bad=%lu "
+           "positions=%lu\n", st->white, st->black, st->draws,
+           st->unfinished, st->bad, st->positions);
+}
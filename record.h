@@ -0,0 +1,76 @@
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#include <stdio.h>
+#include "logic.h"
+
+/* a game record file is an 8 byte header (magic, version, side, the type
+the games were played on, bytes per move) followed by games back to back.
+each game is its moves in order, packed into 1 byte each when the move
+numbers of the side fit (side 4) and 2 little-endian bytes otherwise, then
+one end code of the same width carrying the game's state (0 unfinished,
+1 white won, 2 black won, 3 draw). a move whose placement won is stored
+with any twist, which is skipped on replay as in make_move */
+
+struct recorder;
+
+typedef struct recorder recorder;
+
+struct record_file;
+
+typedef struct record_file record_file;
+
+struct replay_stats {
+    unsigned long games;
+    unsigned long moves;
+    unsigned long white, black, draws, unfinished; /* recorded outcomes */
+    unsigned long bad;     /* games that failed verification */
+    unsigned long positions; /* lines written by the extraction */
+    double seconds;
+};
+
+typedef struct replay_stats replay_stats;
+
+/* creates the record file at path for games of inputted side and type,
+replacing any file there, and writes its header. sides above 90 cannot be
+recorded */
+recorder* record_create(const char* path, unsigned int side, enum type type);
+
+/* adds move m to the game being streamed into r */
+void record_move(recorder* r, move m);
+
+/* ends the game being streamed into r with state, writing it out whole */
+void record_end(recorder* r, int state);
+
+/* writes a finished game of n moves with state in one piece. unlike
+record_move and record_end it may be called from several threads at once,
+games from different threads never interleave */
+void record_game(recorder* r, const move* moves, unsigned int n, int state);
+
+/* flushes and closes the file, then frees r */
+void record_close(recorder* r);
+
+/* maps the record file at path into memory. returns NULL if it is missing
+or is not a record file, including when its header gives a side and type no
+board can have or a side too large to record */
+record_file* record_map(const char* path);
+
+/* unmaps a record file */
+void record_unmap(record_file* f);
+
+/* returns the board side the games in f were played on */
+unsigned int record_side(const record_file* f);
+
+/* plays every game in f again on a game of type type, straight from the
+mapped bytes. with verify, checks that every move lands on an empty cell
+of a game still going and that each game ends with the recorded state,
+counting and skipping those that do not. if positions is not NULL, every
+position reached is written to it as one game_to_string line. a game cut
+off by the end of the file is counted as bad */
+void record_replay(const record_file* f, enum type type, int verify,
+                   FILE* positions, replay_stats* st);
+
+/* prints the replay totals and moves per second as key=value lines */
+void replay_report(replay_stats* st);
+
+#endif /* _RECORD_H */
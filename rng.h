@@ -0,0 +1,34 @@
+#ifndef _RNG_H
+#define _RNG_H
+
+#include <stdint.h>
+
+/* xorshift64* generator: one multiply per number, each thread owns one */
+struct rng {
+    uint64_t s;
+};
+
+typedef struct rng rng;
+
+/* seeds a generator, spreading nearby seeds (thread numbers) apart */
+static inline void rng_seed(rng* r, uint64_t seed) {
+    uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    r->s = (z ^ (z >> 31)) | 1; /* state must never be zero */
+}
+
+/* returns the next 64 random bits */
+static inline uint64_t rng_next(rng* r) {
+    r->s ^= r->s >> 12;
+    r->s ^= r->s << 25;
+    r->s ^= r->s >> 27;
+    return r->s * 0x2545f4914f6cdd1dULL;
+}
+
+/* returns a random number below n, without a division */
+static inline unsigned int rng_below(rng* r, unsigned int n) {
+    return (unsigned int)(((rng_next(r) >> 32) * n) >> 32);
+}
+
+#endif /* _RNG_H */
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "eval.h"
+#include "search.h"
+
+/* deepest ply the search keeps buffers for */
+#define SEARCH_MAX_PLY 64
+
+/* larger than any score a search can return */
+#define SCORE_INF (SCORE_WIN + SEARCH_MAX_PLY + 1)
+
+
+struct search {
+    unsigned int side;
+    unsigned int max_moves;      /* MAX_MOVES(side) */
+    move* moves;                 /* one move buffer per ply */
+    int* order;                  /* ordering score of each buffered move */
+    move pv[SEARCH_MAX_PLY][SEARCH_MAX_PLY]; /* triangular PV table */
+    unsigned int pv_len[SEARCH_MAX_PLY];
+    move prev_pv[SEARCH_MAX_PLY]; /* PV of the last finished iteration */
+    unsigned int prev_pv_len;
+    move killers[SEARCH_MAX_PLY][2]; /* quiet moves that caused cutoffs */
+    unsigned int* history;       /* cutoff credit per move, by move value */
+    tt* table;                   /* shared transposition table, or NULL */
+    int canonical;               /* probe by symmetry-canonical hash */
+    unsigned long nodes;
+    unsigned long tt_probes, tt_hits;
+    double deadline;             /* monotonic seconds, 0 for none */
+    atomic_int* stop;            /* set by the main search, for helpers */
+    atomic_int* halt;            /* set from another thread, or NULL */
+    unsigned int skew;           /* extra plies a helper starts at */
+    int stopped;
+};
+
+/* helper function that returns monotonic time in seconds */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/* helper function that empties every killer slot */
+static void clear_killers(search* s) {
+    for (unsigned int ply = 0; ply < SEARCH_MAX_PLY; ply++) {
+        s->killers[ply][0] = MOVE_NONE, s->killers[ply][1] = MOVE_NONE;
+    }
+}
+
+search* search_new(unsigned int side) {
+    search* s = (search*)malloc(sizeof(search));
+    if (s == NULL) {
+        fprintf(stderr, "search_new: malloc failed.\n");
+        exit(1);
+    }
+    s->side = side;
+    s->max_moves = MAX_MOVES(side);
+    s->moves = (move*)malloc(SEARCH_MAX_PLY * s->max_moves * sizeof(move));
+    s->order = (int*)malloc(SEARCH_MAX_PLY * s->max_moves * sizeof(int));
+    /* move values run up to cell << 3 | 7 */
+    s->history = (unsigned int*)calloc(s->max_moves, sizeof(unsigned int));
+    if (s->moves == NULL || s->order == NULL || s->history == NULL) {
+        fprintf(stderr, "search_new: malloc failed.\n");
+        exit(1);
+    }
+    clear_killers(s);
+    s->prev_pv_len = 0;
+    s->table = NULL;
+    s->canonical = 0;
+    s->stop = NULL;
+    s->halt = NULL;
+    s->skew = 0;
+    return s;
+}
+
+void search_set_table(search* s, tt* t, int canonical) {
+    s->table = t;
+    s->canonical = canonical;
+}
+
+void search_share(search* s, atomic_int* stop, unsigned int skew) {
+    s->stop = stop;
+    s->skew = skew;
+}
+
+void search_halt_on(search* s, atomic_int* halt) {
+    s->halt = halt;
+}
+
+void search_free(search* s) {
+    free(s->moves);
+    free(s->order);
+    free(s->history);
+    free(s);
+}
+
+/* helper function that scores a finished game for the player to move,
+preferring quicker wins and slower losses */
+static int terminal_score(game* g, unsigned int ply) {
+    if (g->state == 3) {
+        return 0; /* draw */
+    }
+    turn winner = (g->state == 1) ? WHITE_NEXT : BLACK_NEXT;
+    return (winner == g->next) ? SCORE_WIN - (int)ply : -SCORE_WIN + (int)ply;
+}
+
+/* helper function that makes a win or loss score relative to the node it is
+stored at, so it stays right when the position is reached at another ply */
+static int score_to_tt(int score, unsigned int ply) {
+    if (score >= SCORE_WIN - SEARCH_MAX_PLY) {
+        return score + (int)ply;
+    } else if (score <= -SCORE_WIN + SEARCH_MAX_PLY) {
+        return score - (int)ply;
+    }
+    return score;
+}
+
+/* helper function that undoes score_to_tt for the node probing the table */
+static int score_from_tt(int score, unsigned int ply) {
+    if (score >= SCORE_WIN - SEARCH_MAX_PLY) {
+        return score - (int)ply;
+    } else if (score <= -SCORE_WIN + SEARCH_MAX_PLY) {
+        return score + (int)ply;
+    }
+    return score;
+}
+
+/* helper function that gives each move an ordering score: the table's move
+first, then the previous iteration's PV move, killer moves and history */
+static void score_moves(search* s, move* ms, int* order, unsigned int n,
+unsigned int ply, int on_pv, move tt_move) {
+    move pv_move = (on_pv && ply < s->prev_pv_len) ? s->prev_pv[ply]
+                                                    : MOVE_NONE;
+    for (unsigned int i = 0; i < n; i++) {
+        if (ms[i] == tt_move) {
+            order[i] = 1 << 30;
+        } else if (ms[i] == pv_move) {
+            order[i] = 1 << 29;
+        } else if (ms[i] == s->killers[ply][0]) {
+            order[i] = 1 << 28;
+        } else if (ms[i] == s->killers[ply][1]) {
+            order[i] = 1 << 27;
+        } else {
+            order[i] = (int)(s->history[ms[i]] & 0x07ffffff);
+        }
+    }
+}
+
+/* helper function that swaps the best remaining move into slot i */
+static void pick_move(move* ms, int* order, unsigned int i, unsigned int n) {
+    unsigned int best = i;
+    for (unsigned int j = i + 1; j < n; j++) {
+        if (order[j] > order[best]) {
+            best = j;
+        }
+    }
+    move m = ms[i];
+    int o = order[i];
+    ms[i] = ms[best], order[i] = order[best];
+    ms[best] = m, order[best] = o;
+}
+
+/* helper function that notes a quiet move that caused a beta cutoff */
+static void record_cutoff(search* s, move m, unsigned int ply, int depth) {
+    if (s->killers[ply][0] != m) {
+        s->killers[ply][1] = s->killers[ply][0];
+        s->killers[ply][0] = m;
+    }
+    s->history[m] += (unsigned int)(depth * depth);
+}
+
+/* negamax alpha-beta with principal variation search: the first move gets
+the full window, the rest a null window and a re-search if they beat it.
+the transposition table can cut a node off or supply its first move */
+static int negamax(search* s, game* g, int depth, int alpha, int beta,
+unsigned int ply, int on_pv) {
+    s->pv_len[ply] = 0;
+    s->nodes++;
+    if (g->state != 0) {
+        return terminal_score(g, ply);
+    }
+    if ((s->nodes & 1023) == 0
+        && ((s->deadline > 0 && now_seconds() >= s->deadline)
+            || (s->stop != NULL
+                && atomic_load_explicit(s->stop, memory_order_relaxed))
+            || (s->halt != NULL
+                && atomic_load_explicit(s->halt, memory_order_relaxed)))) {
+        s->stopped = 1;
+    }
+    if (s->stopped) {
+        return 0;
+    }
+    if (depth == 0 || ply + 1 >= SEARCH_MAX_PLY) {
+        return eval_score(g); /* kept up to date by every move */
+    }
+    int alpha_orig = alpha;
+    unsigned int sym = 0;
+    uint64_t key = 0;
+    move tt_move = MOVE_NONE, best_move = MOVE_NONE;
+    if (s->table != NULL) {
+        tt_hit h;
+        key = s->canonical ? game_canonical_hash(g, &sym) : game_hash(g);
+        s->tt_probes++;
+        if (tt_probe(s->table, key, &h)) {
+            s->tt_hits++;
+            if (h.best != MOVE_NONE) { /* in the canonical image's frame */
+                tt_move = s->canonical ? move_symmetry(h.best, s->side,
+                                                       symmetry_inverse(sym))
+                                       : h.best;
+            }
+            int v = score_from_tt(h.score, ply);
+            if (ply > 0 && h.depth >= depth
+                && ((h.b == BOUND_EXACT)
+                    || (h.b == BOUND_LOWER && v >= beta)
+                    || (h.b == BOUND_UPPER && v <= alpha))) {
+                return v;
+            }
+        }
+    }
+    move* ms = &s->moves[ply * s->max_moves];
+    int* order = &s->order[ply * s->max_moves];
+    unsigned int n = generate_unique_moves(g, ms, 0), i;
+    score_moves(s, ms, order, n, ply, on_pv, tt_move);
+    int best = -SCORE_INF;
+    for (i = 0; i < n; i++) {
+        pick_move(ms, order, i, n);
+        move m = ms[i];
+        int child_pv = on_pv && ply < s->prev_pv_len && m == s->prev_pv[ply];
+        int v;
+        make_move(g, m);
+        if (i == 0) {
+            v = -negamax(s, g, depth - 1, -beta, -alpha, ply + 1, child_pv);
+        } else {
+            v = -negamax(s, g, depth - 1, -alpha - 1, -alpha, ply + 1,
+                         child_pv);
+            if (v > alpha && v < beta && !s->stopped) {
+                v = -negamax(s, g, depth - 1, -beta, -alpha, ply + 1,
+                             child_pv);
+            }
+        }
+        unmake_move(g, m);
+        if (s->stopped) {
+            return 0;
+        }
+        if (v > best) {
+            best = v;
+            best_move = m;
+            if (v > alpha) {
+                alpha = v;
+                s->pv[ply][0] = m; /* this move plus the child's line */
+                memcpy(&s->pv[ply][1], s->pv[ply + 1],
+                       s->pv_len[ply + 1] * sizeof(move));
+                s->pv_len[ply] = s->pv_len[ply + 1] + 1;
+                if (alpha >= beta) {
+                    record_cutoff(s, m, ply, depth);
+                    break;
+                }
+            }
+        }
+    }
+    if (s->table != NULL) {
+        bound b = (best <= alpha_orig) ? BOUND_UPPER
+                : (best >= beta) ? BOUND_LOWER : BOUND_EXACT;
+        move stored = (s->canonical && best_move != MOVE_NONE)
+                    ? move_symmetry(best_move, s->side, sym) : best_move;
+        tt_store(s->table, key, stored, score_to_tt(best, ply), depth, b);
+    }
+    return best;
+}
+
+search_result search_run(search* s, game* g, unsigned int max_depth,
+unsigned int movetime_ms) {
+    search_result res;
+    double start = now_seconds();
+    res.best = MOVE_NONE, res.ponder = MOVE_NONE;
+    res.score = 0, res.depth = 0;
+    s->nodes = 0;
+    s->tt_probes = 0, s->tt_hits = 0;
+    s->stopped = 0;
+    int attached = (g->ev == NULL); /* leaves need an evaluator */
+    if (attached) {
+        eval_attach(g);
+    }
+    if (s->table != NULL && s->stop == NULL) {
+        tt_new_search(s->table);
+    }
+    s->prev_pv_len = 0;
+    s->deadline = movetime_ms ? start + (movetime_ms / 1000.0) : 0;
+    clear_killers(s);
+    unsigned int empty = (g->b->side * g->b->side) - g->filled;
+    if (max_depth > empty) { /* every ply fills a cell */
+        max_depth = empty;
+    }
+    if (max_depth >= SEARCH_MAX_PLY) {
+        max_depth = SEARCH_MAX_PLY - 1;
+    }
+    if (g->state == 0) {
+        generate_unique_moves(g, s->moves, 0); /* if depth 1 runs out */
+        res.best = s->moves[0];
+    }
+    for (unsigned int d = 1 + s->skew; d <= max_depth && g->state == 0; d++) {
+        int v = negamax(s, g, (int)d, -SCORE_INF, SCORE_INF, 0, 1);
+        if (s->stopped) {
+            break; /* keep the last iteration that finished */
+        }
+        res.score = v, res.depth = d;
+        if (s->pv_len[0] > 0) {
+            res.best = s->pv[0][0];
+            res.ponder = (s->pv_len[0] > 1) ? s->pv[0][1] : MOVE_NONE;
+            memcpy(s->prev_pv, s->pv[0], s->pv_len[0] * sizeof(move));
+            s->prev_pv_len = s->pv_len[0];
+        }
+        if (v >= SCORE_WIN - SEARCH_MAX_PLY
+            || v <= -SCORE_WIN + SEARCH_MAX_PLY) {
+            break; /* result is proven, deeper search cannot change it */
+        }
+    }
+    res.nodes = s->nodes;
+    res.tt_probes = s->tt_probes, res.tt_hits = s->tt_hits;
+    res.seconds = now_seconds() - start;
+    if (attached) {
+        eval_detach(g);
+    }
+    return res;
+}
@@ -0,0 +1,56 @@
+#ifndef _SEARCH_H
+#define _SEARCH_H
+
+#include "logic.h"
+#include "tt.h"
+
+/* scores within a ply count of this mean a forced win for the player to
+move, static evaluations always stay well below it */
+#define SCORE_WIN (1 << 29)
+
+
+struct search_result {
+    move best;           /* best move found, MOVE_NONE if the game is over */
+    move ponder;         /* the reply expected to best, or MOVE_NONE */
+    int score;           /* from the point of view of the player to move */
+    unsigned int depth;  /* deepest iteration that finished */
+    unsigned long nodes; /* positions visited */
+    double seconds;      /* wall time spent */
+    unsigned long tt_probes; /* transposition table lookups */
+    unsigned long tt_hits;   /* lookups that found their position */
+};
+
+typedef struct search_result search_result;
+
+struct search;
+
+typedef struct search search;
+
+/* creates the state an alpha-beta search keeps between moves (killer moves,
+history scores and principal variation) for boards of inputted side */
+search* search_new(unsigned int side);
+
+/* frees a search */
+void search_free(search* s);
+
+/* makes s share transposition table t (NULL for none). if canonical is
+nonzero positions are looked up by their hash over the symmetry group, so
+symmetric positions share one entry */
+void search_set_table(search* s, tt* t, int canonical);
+
+/* makes s a helper in a parallel search: it also stops once *stop is
+nonzero, starts iterative deepening skew plies deeper so helpers spread
+over depths, and leaves ageing the shared table to the main search */
+void search_share(search* s, atomic_int* stop, unsigned int skew);
+
+/* makes s also stop once *halt is nonzero (NULL for never), so another
+thread can cut a search short. the last iteration that finished stands */
+void search_halt_on(search* s, atomic_int* halt);
+
+/* finds a move for the player to move in g by iterative deepening up to
+max_depth plies, stopping early once movetime_ms milliseconds have passed
+(0 for no time limit). g is searched in place and left as it was */
+search_result search_run(search* s, game* g, unsigned int max_depth,
+                         unsigned int movetime_ms);
+
+#endif /* _SEARCH_H */
@@ -0,0 +1,570 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "protocol.h"
+#include "rng.h"
+#include "server.h"
+
+/* longest command a connection may send */
+#define SERVER_LINE 256
+
+/* move times are counted in buckets a sixteenth of an octave wide, from
+1 ns up to about 4 s, so percentiles come within about 2% without keeping
+or sorting the times */
+#define SERVER_BUCKETS 512
+#define BUCKETS_PER_OCTAVE 16
+
+/* epoll tag of the listening socket, sessions are tagged by slot */
+#define LISTENER 0xFFFFFFFFu
+
+static const char* winners[4] = {"none", "white", "black", "draw"};
+
+/* one connection and its game */
+struct session {
+    int fd;
+    game* g;
+    unsigned int in_used;
+    unsigned int out_used;
+    unsigned int out_sent;
+    int waiting;          /* answers are queued, reading is paused */
+    char in[SERVER_LINE];
+    char* out;            /* room for the answer to one command */
+};
+
+struct server {
+    int listen_fd;
+    int epoll_fd;
+    game_arena* games;
+    struct session* sessions;
+    unsigned int* free_slots; /* stack of unused session numbers */
+    unsigned int free_count;
+    unsigned int out_room;   /* longest answer, the board line */
+    unsigned int peak;
+    unsigned long accepted;
+    unsigned long moves;
+    unsigned long times[SERVER_BUCKETS]; /* moves per time bucket */
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+/* helper function that asks the event loop to finish */
+static void stop(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+/* helper function that returns monotonic time in seconds */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/* helper function that returns the CPU time this process has used */
+static double cpu_seconds(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + (ru.ru_utime.tv_usec / 1e6)
+         + ru.ru_stime.tv_sec + (ru.ru_stime.tv_usec / 1e6);
+}
+
+/* helper function that lifts the open file limit as far as it goes, since
+every session is a descriptor */
+static void raise_file_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+/* helper function that fills addr with the socket path, exiting if it
+does not fit */
+static void socket_address(struct sockaddr_un* addr, const char* path,
+const char* caller) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "%s: socket path %s is too long.\n", caller, path);
+        exit(1);
+    }
+    strcpy(addr->sun_path, path);
+}
+
+/* helper function for qsort that orders times */
+static int compare_times(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* helper function that sorts the n times at v and returns the fraction p
+percentile, in microseconds */
+static double percentile_us(double* v, unsigned long n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    qsort(v, n, sizeof(double), compare_times);
+    return v[(unsigned long)(p * (n - 1))] * 1e6;
+}
+
+/* helper function that returns the time bucket of a move that took
+inputted seconds */
+static unsigned int time_bucket(double seconds) {
+    double ns = seconds * 1e9;
+    if (ns < 1) {
+        return 0;
+    }
+    double b = log2(ns) * BUCKETS_PER_OCTAVE;
+    return (b < SERVER_BUCKETS - 1) ? (unsigned int)b : SERVER_BUCKETS - 1;
+}
+
+/* helper function that returns the fraction p percentile of the move
+times counted in s, in microseconds, as the middle of its bucket */
+static double bucket_percentile_us(struct server* s, double p) {
+    if (s->moves == 0) {
+        return 0;
+    }
+    unsigned long rank = (unsigned long)(p * (s->moves - 1)), seen = 0;
+    unsigned int b;
+    for (b = 0; b < SERVER_BUCKETS - 1; b++) {
+        seen += s->times[b];
+        if (seen > rank) {
+            break;
+        }
+    }
+    return exp2((b + 0.5) / BUCKETS_PER_OCTAVE) / 1e3;
+}
+
+/* helper function that writes the server's totals to out as key=value
+fields */
+static void server_stats(struct server* s, char* out, size_t room) {
+    double p50 = bucket_percentile_us(s, 0.5);
+    double p99 = bucket_percentile_us(s, 0.99);
+    snprintf(out, room, "sessions=%u peak=%u accepted=%lu moves=%lu "
+             "cpu=%.3f move_p50_us=%.2f move_p99_us=%.2f",
+             game_arena_used(s->games), s->peak, s->accepted, s->moves,
+             cpu_seconds(), p50, p99);
+}
+
+/* helper function that hangs up on session slot and frees its slot */
+static void close_session(struct server* s, unsigned int slot) {
+    struct session* c = &s->sessions[slot];
+    epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    game_arena_release(s->games, c->g);
+    c->fd = -1;
+    s->free_slots[s->free_count++] = slot;
+}
+
+/* helper function that answers one command line of session c. returns 1
+if the connection should be closed */
+static int answer(struct server* s, struct session* c, char* line) {
+    char* out = c->out + c->out_used;
+    size_t room = s->out_room;
+    char* cmd = strtok(line, " \t\r");
+    char* arg = (cmd == NULL) ? NULL : strtok(NULL, " \t\r");
+    unsigned int side = c->g->b->side;
+    int len = 0;
+    if (cmd == NULL) {
+        return 0;
+    } else if (strcmp(cmd, "move") == 0) {
+        double start = now_seconds();
+        move m;
+        if (arg == NULL || !move_parse(arg, side, &m) || c->g->state != 0
+            || board_get(c->g->b, make_pos(MOVE_CELL(m) / side,
+                                           MOVE_CELL(m) % side)) != EMPTY) {
+            len = snprintf(out, room, "error illegal move %s\n",
+                           (arg == NULL) ? "" : arg);
+        } else {
+            make_move(c->g, m);
+            len = snprintf(out, room, "ok %s\n", winners[c->g->state]);
+            s->times[time_bucket(now_seconds() - start)]++;
+            s->moves++;
+        }
+    } else if (strcmp(cmd, "newgame") == 0) {
+        game_reset(c->g);
+        len = snprintf(out, room, "ok\n");
+    } else if (strcmp(cmd, "board") == 0) {
+        memcpy(out, "board ", 6);
+        game_to_string(c->g, out + 6);
+        len = 6 + strlen(out + 6);
+        out[len++] = '\n';
+    } else if (strcmp(cmd, "stats") == 0) {
+        memcpy(out, "stats ", 6);
+        server_stats(s, out + 6, room - 7);
+        len = 6 + strlen(out + 6);
+        out[len++] = '\n';
+    } else if (strcmp(cmd, "quit") == 0) {
+        return 1;
+    } else {
+        len = snprintf(out, room, "error unknown command %.32s\n", cmd);
+    }
+    c->out_used += len;
+    return 0;
+}
+
+/* helper function that sends what c has queued. returns 1 if the
+connection broke */
+static int send_queued(struct session* c) {
+    while (c->out_sent < c->out_used) {
+        ssize_t n = send(c->fd, c->out + c->out_sent,
+                         c->out_used - c->out_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            return errno != EAGAIN && errno != EWOULDBLOCK;
+        }
+        c->out_sent += n;
+    }
+    c->out_used = 0, c->out_sent = 0;
+    return 0;
+}
+
+/* helper function that answers every whole line c has sent, one at a time
+so the queue never holds more than one answer, and watches for writing
+instead of reading while an answer is stuck. returns 1 if the connection
+should be closed */
+static int serve_lines(struct server* s, struct session* c) {
+    char* end;
+    while (c->out_used == 0
+           && (end = memchr(c->in, '\n', c->in_used)) != NULL) {
+        unsigned int len = end - c->in + 1;
+        *end = '\0';
+        if (answer(s, c, c->in) || send_queued(c)) {
+            return 1;
+        }
+        memmove(c->in, c->in + len, c->in_used - len);
+        c->in_used -= len;
+    }
+    if (c->out_used == 0 && c->in_used == SERVER_LINE) {
+        return 1; /* a command longer than any the server knows */
+    }
+    int waiting = c->out_used != 0;
+    if (waiting != c->waiting) {
+        struct epoll_event ev;
+        ev.events = waiting ? EPOLLOUT : EPOLLIN;
+        ev.data.u32 = (unsigned int)(c - s->sessions);
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->waiting = waiting;
+    }
+    return 0;
+}
+
+/* helper function that takes every waiting connection, turning away those
+that find every slot taken */
+static void accept_sessions(struct server* s) {
+    int fd;
+    while ((fd = accept(s->listen_fd, NULL, NULL)) >= 0) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        game* g = (s->free_count > 0) ? game_arena_alloc(s->games) : NULL;
+        if (g == NULL) {
+            const char full[] = "error server full\n";
+            send(fd, full, sizeof(full) - 1, MSG_NOSIGNAL);
+            close(fd);
+            continue;
+        }
+        unsigned int slot = s->free_slots[--s->free_count];
+        struct session* c = &s->sessions[slot];
+        c->fd = fd, c->g = g;
+        c->in_used = 0, c->out_used = 0, c->out_sent = 0, c->waiting = 0;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = slot;
+        if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close_session(s, slot);
+            continue;
+        }
+        s->accepted++;
+        if (game_arena_used(s->games) > s->peak) {
+            s->peak = game_arena_used(s->games);
+        }
+    }
+}
+
+void server_run(const char* path, unsigned int side, enum type type,
+unsigned int max_sessions) {
+    struct server s;
+    struct sockaddr_un addr;
+    struct stat st;
+    unsigned int i;
+    socket_address(&addr, path, "server_run");
+    memset(&s, 0, sizeof(s));
+    s.games = game_arena_new(side, type, max_sessions);
+    if (s.games == NULL) {
+        fprintf(stderr, "server_run: could not make room for %u games.\n",
+                max_sessions);
+        exit(1);
+    }
+    s.out_room = (side * side) + 256; /* the board or stats line */
+    s.sessions = (struct session*)malloc(max_sessions
+                                         * sizeof(struct session));
+    s.free_slots = (unsigned int*)malloc(max_sessions * sizeof(unsigned int));
+    char* outs = (char*)malloc((size_t)max_sessions * s.out_room);
+    if (s.sessions == NULL || s.free_slots == NULL || outs == NULL) {
+        fprintf(stderr, "server_run: malloc failed.\n");
+        exit(1);
+    }
+    for (i = 0; i < max_sessions; i++) { /* slot 0 is handed out first */
+        s.sessions[i].fd = -1;
+        s.sessions[i].out = outs + ((size_t)i * s.out_room);
+        s.free_slots[i] = max_sessions - 1 - i;
+    }
+    s.free_count = max_sessions;
+    raise_file_limit();
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path); /* left behind by a server that did not finish */
+    }
+    s.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (s.listen_fd < 0
+        || bind(s.listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+        || listen(s.listen_fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "server_run: could not listen on %s.\n", path);
+        exit(1);
+    }
+    s.epoll_fd = epoll_create1(0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = LISTENER;
+    if (s.epoll_fd < 0
+        || epoll_ctl(s.epoll_fd, EPOLL_CTL_ADD, s.listen_fd, &ev) != 0) {
+        fprintf(stderr, "server_run: could not start the event loop.\n");
+        exit(1);
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop; /* no SA_RESTART, so epoll_wait returns */
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    printf("server listening on %s side=%u sessions=%u\n", path, side,
+           max_sessions);
+    fflush(stdout);
+    struct epoll_event events[256];
+    while (!stopping) {
+        int n = epoll_wait(s.epoll_fd, events, 256, -1);
+        for (int k = 0; k < n; k++) {
+            unsigned int slot = events[k].data.u32;
+            if (slot == LISTENER) {
+                accept_sessions(&s);
+                continue;
+            }
+            struct session* c = &s.sessions[slot];
+            if (c->fd < 0) {
+                continue; /* closed earlier in this batch */
+            }
+            int done = 0;
+            if (c->waiting) {
+                done = send_queued(c);
+            } else {
+                ssize_t got = recv(c->fd, c->in + c->in_used,
+                                   SERVER_LINE - c->in_used, 0);
+                if (got > 0) {
+                    c->in_used += got;
+                } else {
+                    done = got == 0 || (errno != EAGAIN
+                                        && errno != EWOULDBLOCK);
+                }
+            }
+            if (done || serve_lines(&s, c)) {
+                close_session(&s, slot);
+            }
+        }
+    }
+    char totals[256];
+    server_stats(&s, totals, sizeof(totals));
+    printf("server %s\n", totals);
+    for (i = 0; i < max_sessions; i++) {
+        if (s.sessions[i].fd >= 0) {
+            close_session(&s, i);
+        }
+    }
+    close(s.epoll_fd);
+    close(s.listen_fd);
+    unlink(path);
+    free(outs);
+    free(s.free_slots);
+    free(s.sessions);
+    game_arena_free(s.games);
+}
+
+/* one load generator connection and its copy of the game */
+struct client {
+    int fd;
+    game* g;
+    int awaiting;         /* 1 for a move's answer, 2 for newgame's */
+    double sent;          /* when the awaited command went out */
+    unsigned int in_used;
+    char in[SERVER_LINE];
+};
+
+/* helper function that opens a blocking connection to the server */
+static int connect_server(const char* path) {
+    struct sockaddr_un addr;
+    socket_address(&addr, path, "server_load");
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "server_load: could not connect to %s.\n", path);
+        exit(1);
+    }
+    return fd;
+}
+
+/* helper function that sends text whole, exiting if the server is gone */
+static void send_all(int fd, const char* text, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, text, len, MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            continue; /* one short command, the buffer drains at once */
+        } else if (n <= 0) {
+            fprintf(stderr, "server_load: the server hung up.\n");
+            exit(1);
+        }
+        text += n, len -= n;
+    }
+}
+
+/* helper function that asks the server for its CPU time over a blocking
+control connection */
+static double server_cpu(int fd) {
+    char answer[512];
+    size_t used = 0;
+    send_all(fd, "stats\n", 6);
+    while (used == 0 || answer[used - 1] != '\n') {
+        ssize_t n = recv(fd, answer + used, sizeof(answer) - 1 - used, 0);
+        if (n <= 0) {
+            fprintf(stderr, "server_load: the server hung up.\n");
+            exit(1);
+        }
+        used += n;
+    }
+    answer[used] = '\0';
+    char* cpu = strstr(answer, "cpu=");
+    return (cpu != NULL) ? atof(cpu + 4) : 0;
+}
+
+/* helper function that plays a random move on c's copy of the game and
+sends it */
+static void send_move(struct client* c, rng* r, move* ms) {
+    char text[16];
+    unsigned int n = generate_moves(c->g, ms);
+    move m = ms[rng_below(r, n)];
+    memcpy(text, "move ", 5);
+    move_format(m, c->g->b->side, text + 5);
+    text[10] = '\n';
+    make_move(c->g, m);
+    c->awaiting = 1;
+    c->sent = now_seconds();
+    send_all(c->fd, text, 11);
+}
+
+void server_load(const char* path, unsigned int side, enum type type,
+unsigned int sessions, unsigned long moves, uint64_t seed) {
+    game_arena* games = game_arena_new(side, type, sessions);
+    struct client* clients = (struct client*)malloc(sessions
+                                                    * sizeof(struct client));
+    double* times = (double*)malloc(moves * sizeof(double));
+    move* ms = (move*)malloc(MAX_MOVES(side) * sizeof(move));
+    if (games == NULL || clients == NULL || times == NULL || ms == NULL) {
+        fprintf(stderr, "server_load: malloc failed.\n");
+        exit(1);
+    }
+    raise_file_limit();
+    rng r;
+    rng_seed(&r, seed);
+    int control = connect_server(path);
+    int epoll_fd = epoll_create1(0);
+    unsigned long sent = 0, answered = 0, mismatches = 0;
+    unsigned int active = 0, i;
+    for (i = 0; i < sessions; i++) {
+        struct client* c = &clients[i];
+        c->fd = connect_server(path);
+        c->g = game_arena_alloc(games);
+        c->in_used = 0;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) != 0) {
+            fprintf(stderr, "server_load: could not watch session %u.\n", i);
+            exit(1);
+        }
+    }
+    double cpu_start = server_cpu(control), start = now_seconds();
+    for (i = 0; i < sessions; i++) { /* every session starts at once */
+        if (sent < moves) {
+            send_move(&clients[i], &r, ms);
+            sent++, active++;
+        } else {
+            clients[i].awaiting = 0;
+        }
+    }
+    struct epoll_event events[256];
+    while (active > 0) {
+        int n = epoll_wait(epoll_fd, events, 256, -1);
+        for (int k = 0; k < n; k++) {
+            struct client* c = &clients[events[k].data.u32];
+            ssize_t got = recv(c->fd, c->in + c->in_used,
+                               SERVER_LINE - c->in_used, 0);
+            if (got <= 0) {
+                fprintf(stderr, "server_load: the server hung up.\n");
+                exit(1);
+            }
+            c->in_used += got;
+            char* end = memchr(c->in, '\n', c->in_used);
+            if (end == NULL) {
+                continue; /* one answer at a time, never more */
+            }
+            *end = '\0';
+            if (c->awaiting == 1) {
+                times[answered++] = now_seconds() - c->sent;
+                mismatches += strncmp(c->in, "ok ", 3) != 0
+                           || strcmp(c->in + 3, winners[c->g->state]) != 0;
+            }
+            c->in_used = 0;
+            if (c->awaiting == 1 && c->g->state != 0) {
+                c->awaiting = 2;
+                send_all(c->fd, "newgame\n", 8);
+                continue;
+            } else if (c->awaiting == 2) {
+                game_reset(c->g);
+            }
+            if (sent < moves) {
+                send_move(c, &r, ms);
+                sent++;
+            } else {
+                c->awaiting = 0;
+                active--;
+            }
+        }
+    }
+    double seconds = now_seconds() - start;
+    double cpu = server_cpu(control) - cpu_start;
+    double p50 = percentile_us(times, answered, 0.5);
+    double p99 = percentile_us(times, answered, 0.99);
+    printf("load sessions=%u moves=%lu seconds=%.3f moves/s=%.0f "
+           "p50_us=%.1f p99_us=%.1f mismatches=%lu\n", sessions, answered,
+           seconds, (seconds > 0) ? answered / seconds : 0.0, p50, p99,
+           mismatches);
+    /* cores the server kept busy over the run, and what one core carries */
+    double cores = (seconds > 0) ? cpu / seconds : 0;
+    printf("load_server cpu=%.3f cores=%.2f moves/core_s=%.0f "
+           "sessions/core=%.0f\n", cpu, cores,
+           (cpu > 0) ? answered / cpu : 0.0,
+           (cores > 0) ? sessions / cores : 0.0);
+    for (i = 0; i < sessions; i++) {
+        close(clients[i].fd);
+    }
+    close(control);
+    close(epoll_fd);
+    free(ms);
+    free(times);
+    free(clients);
+    game_arena_free(games);
+}
@@ -0,0 +1,33 @@
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include <stdint.h>
+#include "logic.h"
+
+/* serves games of inputted side and type to clients of the Unix socket at
+path, one game per connection, on a single thread: an epoll loop wakes
+only for connections with something to read or write, and each game is a
+slot of one game arena holding up to max_sessions. a connection sends one
+command per line and gets one line back:
+  newgame    empty board, answers ok
+  move M     plays M (as move_format writes it) after checking the cell is
+             empty and the game still going, answers ok and the winner so
+             far (none, white, black or draw)
+  board      answers board and the position as game_to_string writes it
+  stats      answers the server's totals as key=value fields
+  quit       closes the connection
+anything else is answered with a line starting "error". runs until
+interrupted, then prints the totals and removes the socket */
+void server_run(const char* path, unsigned int side, enum type type,
+                unsigned int max_sessions);
+
+/* local load generator for server_run: opens sessions connections to the
+socket at path and plays random games on all of them at once, each sending
+its next move as soon as the last is answered, until moves moves have been
+played in all. checks every answer against its own copy of the game, then
+prints the round trip latency percentiles, moves per second, and the CPU
+the server spent, as moves and sessions per core */
+void server_load(const char* path, unsigned int side, enum type type,
+                 unsigned int sessions, unsigned long moves, uint64_t seed);
+
+#endif /* _SERVER_H */
@@ -0,0 +1,168 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim.h"
+
+/* what each simulation thread is given and fills in */
+struct worker {
+    unsigned int side;
+    enum type type;
+    unsigned long games;
+    uint64_t seed;
+    policy p;
+    game* g;          /* allocated before the thread starts, reused */
+    recorder* rec;    /* shared by every thread, or NULL */
+    move* played;     /* the game's moves when recording */
+    sim_stats tally;  /* this thread's own counts */
+};
+
+/* helper function that returns a cell completing one of the mover's lines,
+or -1 if no placement wins on the spot */
+static int winning_cell(game* g) {
+    unsigned int own = (g->next == WHITE_NEXT) ? 1 : 0, i, k;
+    const lines* l = g->lines;
+    for (i = 0; i < l->count; i++) {
+        if (g->counts[(2 * i) + own] == l->len - 1
+            && g->counts[(2 * i) + !own] == 0) {
+            for (k = 0; k < l->len; k++) { /* find the one gap */
+                unsigned int cell = l->cells[(i * l->len) + k];
+                pos p = make_pos(cell / l->side, cell % l->side);
+                if (board_get(g->b, p) == EMPTY) {
+                    return (int)cell;
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+unsigned int sim_playout(game* g, rng* r, policy p, move* played) {
+    unsigned int side = g->b->side, cells = side * side, plies = 0;
+    while (g->state == 0) {
+        int cell = (p == GREEDY) ? winning_cell(g) : -1;
+        while (cell < 0) { /* rejection sampling: retry until empty */
+            unsigned int c = rng_below(r, cells);
+            if (board_get(g->b, make_pos(c / side, c % side)) == EMPTY) {
+                cell = (int)c;
+            }
+        }
+        unsigned int twist = rng_below(r, 8);
+        move m = MOVE((unsigned int)cell, twist >> 1, twist & 1);
+        make_move(g, m);
+        if (played != NULL) {
+            played[plies] = m;
+        }
+        plies++;
+    }
+    return plies;
+}
+
+/* simulation thread: plays its share of games on its one game */
+static void* worker_main(void* arg) {
+    struct worker* w = (struct worker*)arg;
+    rng r;
+    rng_seed(&r, w->seed);
+    for (unsigned long i = 0; i < w->games; i++) {
+        game_reset(w->g);
+        unsigned int plies = sim_playout(w->g, &r, w->p, w->played);
+        if (w->rec != NULL) {
+            record_game(w->rec, w->played, plies, w->g->state);
+        }
+        w->tally.lengths[plies]++;
+        if (w->g->state == 1) {
+            w->tally.white++;
+        } else if (w->g->state == 2) {
+            w->tally.black++;
+        } else {
+            w->tally.draws++;
+        }
+    }
+    return NULL;
+}
+
+/* helper function that returns monotonic time in seconds */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+void sim_run(unsigned int side, enum type type, unsigned long games,
+unsigned int threads, uint64_t seed, policy p, recorder* rec,
+sim_stats* out) {
+    unsigned int cells = side * side, i;
+    struct worker* ws = (struct worker*)calloc(threads, sizeof(struct worker));
+    pthread_t* ids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    game_arena* arena = (threads == 0) ? NULL
+                      : game_arena_new(side, type, threads);
+    out->lengths = (unsigned long*)calloc(cells + 1, sizeof(unsigned long));
+    if (ws == NULL || ids == NULL || out->lengths == NULL || arena == NULL) {
+        fprintf(stderr, "sim_run: malloc failed.\n");
+        exit(1);
+    }
+    out->side = side;
+    out->games = games;
+    out->white = 0, out->black = 0, out->draws = 0;
+    for (i = 0; i < threads; i++) { /* everything allocated up front */
+        ws[i].side = side, ws[i].type = type, ws[i].p = p;
+        ws[i].games = (games / threads) + (i < games % threads);
+        ws[i].seed = seed + i;
+        ws[i].g = game_arena_alloc(arena); /* one cache-aligned block */
+        ws[i].rec = rec;
+        ws[i].played = (rec != NULL) ? (move*)malloc(cells * sizeof(move))
+                                     : NULL;
+        ws[i].tally.lengths = (unsigned long*)calloc(cells + 1,
+                                                     sizeof(unsigned long));
+        if (ws[i].tally.lengths == NULL
+            || (rec != NULL && ws[i].played == NULL)) {
+            fprintf(stderr, "sim_run: malloc failed.\n");
+            exit(1);
+        }
+    }
+    double start = now_seconds();
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&ids[i], NULL, worker_main, &ws[i]) != 0) {
+            fprintf(stderr, "sim_run: could not start a thread.\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+        out->white += ws[i].tally.white;
+        out->black += ws[i].tally.black;
+        out->draws += ws[i].tally.draws;
+        for (unsigned int k = 0; k <= cells; k++) {
+            out->lengths[k] += ws[i].tally.lengths[k];
+        }
+        free(ws[i].played);
+        free(ws[i].tally.lengths);
+    }
+    out->seconds = now_seconds() - start;
+    game_arena_free(arena);
+    free(ws);
+    free(ids);
+}
+
+void sim_report(sim_stats* st) {
+    double n = st->games ? (double)st->games : 1.0, total = 0;
+    for (unsigned int k = 0; k <= st->side * st->side; k++) {
+        total += (double)k * st->lengths[k];
+    }
+    printf("simulate side=%u games=%lu seconds=%.3f games/min=%.0f\n",
+           st->side, st->games, st->seconds,
+           (st->seconds > 0) ? (60.0 * st->games) / st->seconds : 0.0);
+    printf("outcomes white=%.4f black=%.4f draw=%.4f mean_length=%.2f\n",
+           st->white / n, st->black / n, st->draws / n, total / n);
+    for (unsigned int k = 0; k <= st->side * st->side; k++) {
+        if (st->lengths[k]) {
+            printf("length plies=%u games=%lu\n", k, st->lengths[k]);
+        }
+    }
+}
+
+void sim_stats_free(sim_stats* st) {
+    free(st->lengths);
+    st->lengths = NULL;
+}
@@ -0,0 +1,51 @@
+#ifndef _SIM_H
+#define _SIM_H
+
+#include <stdint.h>
+#include "logic.h"
+#include "record.h"
+#include "rng.h"
+
+/* how simulated players choose their moves */
+enum policy {
+    RANDOM, /* uniformly random empty cell, quadrant and direction */
+    GREEDY  /* completes a winning line when it can, random otherwise */
+};
+
+typedef enum policy policy;
+
+
+struct sim_stats {
+    unsigned int side;
+    unsigned long games;
+    unsigned long white, black, draws; /* outcomes */
+    unsigned long* lengths; /* games that lasted i plies, side * side + 1 */
+    double seconds;
+};
+
+typedef struct sim_stats sim_stats;
+
+/* plays g out to the end with both players following policy p, drawing
+from r, and returns the number of plies played. the moves are stored in
+played unless it is NULL, which needs room for one per empty cell. never
+allocates */
+unsigned int sim_playout(game* g, rng* r, policy p, move* played);
+
+/* plays games games between two players following policy p on
+boards of inputted side and type, spread over threads threads. each thread
+seeds its own generator from seed, reuses one preallocated game and keeps
+its own tallies, so no memory is allocated per game. every game is also
+written to rec unless it is NULL. the totals are written to out, whose
+lengths array is allocated here */
+void sim_run(unsigned int side, enum type type, unsigned long games,
+             unsigned int threads, uint64_t seed, policy p, recorder* rec,
+             sim_stats* out);
+
+/* prints outcome rates, throughput and the game-length histogram, one
+key=value line each */
+void sim_report(sim_stats* st);
+
+/* frees the histogram of a finished run */
+void sim_stats_free(sim_stats* st);
+
+#endif /* _SIM_H */
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "eval.h"
+#include "smp.h"
+
+
+/* arguments handed to each helper thread */
+struct helper {
+    struct smp* p;
+    unsigned int i;
+};
+
+struct smp {
+    unsigned int threads;
+    search** searchers;     /* searchers[0] runs on the calling thread */
+    game** games;           /* each helper's own copy, games[0] unused */
+    pthread_t* ids;
+    tt* table;
+    atomic_int stop;        /* raised when the main search is done */
+    unsigned int max_depth; /* limit of the current run, for helpers */
+    search_result* results; /* what each helper returned */
+    struct helper* args;
+    atomic_int halt;        /* raised to cut the main search short */
+    game* ponder;           /* the position searched in the background */
+    uint64_t ponder_hash;   /* its hash, ponder itself is being searched */
+    pthread_t ponder_id;
+    int pondering;          /* a background search has been started */
+    atomic_int ponder_done; /* and has finished by itself */
+    unsigned int ponder_depth;
+    double ponder_start;
+    search_result ponder_result;
+};
+
+/* helper function that returns monotonic time in seconds */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+smp* smp_new(unsigned int side, enum type type, unsigned int threads, tt* t,
+int canonical) {
+    smp* p = (smp*)malloc(sizeof(smp));
+    if (p == NULL || threads == 0) {
+        fprintf(stderr, "smp_new: need at least one thread.\n");
+        exit(1);
+    }
+    p->threads = threads;
+    p->table = t;
+    p->searchers = (search**)malloc(threads * sizeof(search*));
+    p->games = (game**)malloc(threads * sizeof(game*));
+    p->ids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    p->results = (search_result*)malloc(threads * sizeof(search_result));
+    p->args = (struct helper*)malloc(threads * sizeof(struct helper));
+    if (p->searchers == NULL || p->games == NULL || p->ids == NULL
+        || p->results == NULL || p->args == NULL) {
+        fprintf(stderr, "smp_new: malloc failed.\n");
+        exit(1);
+    }
+    atomic_init(&p->stop, 0);
+    atomic_init(&p->halt, 0);
+    atomic_init(&p->ponder_done, 0);
+    p->ponder = new_game(side, type);
+    p->pondering = 0;
+    for (unsigned int i = 0; i < threads; i++) {
+        p->searchers[i] = search_new(side);
+        search_set_table(p->searchers[i], t, canonical);
+        search_halt_on(p->searchers[i], &p->halt);
+        p->games[i] = (i == 0) ? NULL : new_game(side, type);
+        if (i > 0) { /* odd helpers start one ply deeper than the main */
+            eval_attach(p->games[i]); /* kept between moves */
+            search_share(p->searchers[i], &p->stop, i & 1);
+        }
+    }
+    return p;
+}
+
+void smp_free(smp* p) {
+    smp_ponder_stop(p, 0);
+    game_free(p->ponder);
+    for (unsigned int i = 0; i < p->threads; i++) {
+        search_free(p->searchers[i]);
+        if (p->games[i] != NULL) {
+            game_free(p->games[i]);
+        }
+    }
+    free(p->searchers);
+    free(p->games);
+    free(p->ids);
+    free(p->results);
+    free(p->args);
+    free(p);
+}
+
+/* helper thread: searches its own copy until the main search is done */
+static void* helper_main(void* arg) {
+    struct helper* h = (struct helper*)arg;
+    smp* p = h->p;
+    p->results[h->i] = search_run(p->searchers[h->i], p->games[h->i],
+                                  p->max_depth, 0);
+    return NULL;
+}
+
+search_result smp_run(smp* p, game* g, unsigned int max_depth,
+unsigned int movetime_ms) {
+    atomic_store(&p->stop, 0);
+    p->max_depth = max_depth;
+    for (unsigned int i = 1; i < p->threads; i++) {
+        game_copy(p->games[i], g);
+        p->args[i].p = p, p->args[i].i = i;
+        if (pthread_create(&p->ids[i], NULL, helper_main, &p->args[i]) != 0) {
+            fprintf(stderr, "smp_run: could not start a thread.\n");
+            exit(1);
+        }
+    }
+    search_result res = search_run(p->searchers[0], g, max_depth,
+                                   movetime_ms);
+    atomic_store(&p->stop, 1);
+    for (unsigned int i = 1; i < p->threads; i++) {
+        pthread_join(p->ids[i], NULL);
+        res.nodes += p->results[i].nodes;
+        res.tt_probes += p->results[i].tt_probes;
+        res.tt_hits += p->results[i].tt_hits;
+    }
+    return res;
+}
+
+/* background thread: searches the pondered position until stopped */
+static void* ponder_main(void* arg) {
+    smp* p = (smp*)arg;
+    p->ponder_result = smp_run(p, p->ponder, p->ponder_depth, 0);
+    atomic_store(&p->ponder_done, 1);
+    return NULL;
+}
+
+void smp_ponder(smp* p, game* g, move m, unsigned int max_depth) {
+    smp_ponder_stop(p, 0);
+    game_copy(p->ponder, g);
+    make_move(p->ponder, m);
+    p->ponder_hash = (p->ponder->state == 0) ? game_hash(p->ponder) : 0;
+    atomic_store(&p->halt, 0);
+    atomic_store(&p->ponder_done, 0);
+    p->ponder_depth = max_depth;
+    p->ponder_start = now_seconds();
+    if (pthread_create(&p->ponder_id, NULL, ponder_main, p) != 0) {
+        fprintf(stderr, "smp_ponder: could not start a thread.\n");
+        exit(1);
+    }
+    p->pondering = 1;
+}
+
+int smp_ponder_hit(smp* p, game* g) {
+    return p->pondering && p->ponder_hash != 0
+        && p->ponder_hash == game_hash(g);
+}
+
+search_result smp_ponder_stop(smp* p, unsigned int movetime_ms) {
+    if (!p->pondering) {
+        search_result none;
+        memset(&none, 0, sizeof(none));
+        none.best = MOVE_NONE, none.ponder = MOVE_NONE;
+        return none;
+    }
+    double until = p->ponder_start + (movetime_ms / 1000.0);
+    struct timespec nap = {0, 1000000}; /* looks again every millisecond */
+    while (!atomic_load(&p->ponder_done) && now_seconds() < until) {
+        nanosleep(&nap, NULL);
+    }
+    atomic_store(&p->halt, 1);
+    pthread_join(p->ponder_id, NULL);
+    atomic_store(&p->halt, 0);
+    p->pondering = 0;
+    return p->ponder_result;
+}
+
+void smp_scaling(unsigned int side, enum type type, unsigned int max_threads,
+unsigned int depth, size_t hash_mb) {
+    double base = 0;
+    unsigned int n = 1;
+    printf("threads seconds nodes nodes/sec speedup\n");
+    while (1) { /* powers of two, then max_threads itself */
+        tt* t = tt_new(hash_mb); /* every run starts from a cold table */
+        smp* p = smp_new(side, type, n, t, 0);
+        game* g = new_game(side, type);
+        search_result res = smp_run(p, g, depth, 0);
+        if (n == 1) {
+            base = res.seconds;
+        }
+        printf("%u %.3f %lu %.0f %.2f\n", n, res.seconds, res.nodes,
+               res.nodes / res.seconds, base / res.seconds);
+        game_free(g);
+        smp_free(p);
+        tt_free(t);
+        if (n >= max_threads) {
+            break;
+        }
+        n = (n * 2 < max_threads) ? n * 2 : max_threads;
+    }
+}
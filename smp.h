@@ -0,0 +1,50 @@
+#ifndef _SMP_H
+#define _SMP_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "search.h"
+
+struct smp;
+
+typedef struct smp smp;
+
+/* creates a parallel search over threads threads for games of inputted side
+and type. all threads share transposition table t (probing by symmetric
+hash if canonical is nonzero), and each owns its own copy of the game */
+smp* smp_new(unsigned int side, enum type type, unsigned int threads, tt* t,
+             int canonical);
+
+/* frees a parallel search */
+void smp_free(smp* p);
+
+/* searches g like search_run. the calling thread runs the main search and
+threads - 1 helpers search the same position on their own copies, sharing
+what they find through the table (lazy SMP). stops every helper when the
+main search finishes. nodes and table statistics add up all threads */
+search_result smp_run(smp* p, game* g, unsigned int max_depth,
+                      unsigned int movetime_ms);
+
+/* starts searching, on a background thread and up to max_depth plies
+with no time limit, the position g reaches after move m (not MOVE_NONE)
+while the opponent thinks, filling the shared table. g is copied, not
+kept. any earlier background search is stopped first. p must not run
+anything else until smp_ponder_stop */
+void smp_ponder(smp* p, game* g, move m, unsigned int max_depth);
+
+/* returns 1 if g is the position being searched in the background */
+int smp_ponder_hit(smp* p, game* g);
+
+/* lets the background search run on until movetime_ms milliseconds after
+it started (0 to stop at once) or until it finishes by itself, stops it
+and returns its result, timed from its start. returns an empty result,
+with no moves, if nothing is being searched */
+search_result smp_ponder_stop(smp* p, unsigned int movetime_ms);
+
+/* prints how a depth-limited search from the empty board of inputted side
+and type scales from 1 to max_threads threads: time to depth, nodes/sec
+and speedup over one thread, one line per thread count */
+void smp_scaling(unsigned int side, enum type type, unsigned int max_threads,
+                 unsigned int depth, size_t hash_mb);
+
+#endif /* _SMP_H */
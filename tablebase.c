@@ -0,0 +1,494 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "tablebase.h"
+
+/* the table only covers side 4: 16 cells, 16 bit occupancy masks */
+#define TB_SIDE 4
+#define TB_CELLS 16
+
+/* positions handed to a solver thread at once, a multiple of 4 so no two
+threads write the same byte of either section */
+#define TB_CHUNK 4096
+
+static const char tb_magic[8] = "PTGOTB1";
+
+
+/* file header, followed by the value section (4 positions per byte) and
+then the distance section (2 per byte), each starting on a 64 byte line */
+struct tb_header {
+    char magic[8];
+    uint32_t side;
+    uint32_t layers;               /* marble counts 0 to TB_CELLS */
+    uint64_t start[TB_CELLS + 2];  /* first index of each layer, then total */
+    uint64_t values;               /* file offset of the value section */
+    uint64_t dtes;                 /* file offset of the distance section */
+};
+
+struct tablebase {
+    const unsigned char* map;
+    size_t bytes;
+    const struct tb_header* h;
+    const unsigned char* values;
+    const unsigned char* dtes;
+};
+
+/* index tables, the same for the solver and every reader. a position is
+ranked by the symmetry class of its occupied cells, then by which of those
+cells are white. the white count is fixed by the marble count, since white
+moves first, so the rank is dense */
+static struct {
+    pthread_once_t once;
+    unsigned int binom[TB_CELLS + 1][TB_CELLS + 1];
+    uint16_t image[8][2][256];       /* symmetry image of each mask byte */
+    uint16_t class_of[1 << TB_CELLS]; /* class number within its layer */
+    uint8_t to_canon[1 << TB_CELLS];  /* symmetries onto the class mask */
+    uint16_t canon[1 << TB_CELLS];    /* class masks, layer by layer */
+    unsigned int first_class[TB_CELLS + 2];
+    uint64_t start[TB_CELLS + 2];    /* as in the header */
+    uint64_t line_masks[4 * TB_SIDE + 8];
+    unsigned int lines;
+    uint64_t swap_masks[8][BOARD_MAX_SWAPS];  /* twist k = q * 2 + d */
+    unsigned int swap_deltas[8][BOARD_MAX_SWAPS];
+    unsigned int swaps[8];
+} tb = {PTHREAD_ONCE_INIT};
+
+/* helper function that maps 16 bit mask m through symmetry s */
+static uint16_t sym_mask(unsigned int s, uint16_t m) {
+    return tb.image[s][0][m & 0xff] | tb.image[s][1][m >> 8];
+}
+
+/* helper function that builds the index tables, run once */
+static void tb_init(void) {
+    unsigned int n, k, s, m, cell;
+    for (n = 0; n <= TB_CELLS; n++) {
+        tb.binom[n][0] = 1;
+        for (k = 1; k <= n; k++) {
+            tb.binom[n][k] = tb.binom[n - 1][k - 1]
+                           + ((k < n) ? tb.binom[n - 1][k] : 0);
+        }
+    }
+    for (s = 0; s < 8; s++) {
+        for (m = 0; m < 256; m++) {
+            uint16_t lo = 0, hi = 0;
+            for (cell = 0; cell < 8; cell++) {
+                if ((m >> cell) & 1) {
+                    pos a = board_symmetry(make_pos(cell / 4, cell % 4), 4, s);
+                    pos b = board_symmetry(make_pos((cell + 8) / 4, cell % 4),
+                                           4, s);
+                    lo |= (uint16_t)(1u << ((a.r * 4) + a.c));
+                    hi |= (uint16_t)(1u << ((b.r * 4) + b.c));
+                }
+            }
+            tb.image[s][0][m] = lo, tb.image[s][1][m] = hi;
+        }
+    }
+    /* classes numbered in increasing order of their smallest image */
+    unsigned int classes[TB_CELLS + 1] = {0}, next = 0;
+    for (m = 0; m < (1u << TB_CELLS); m++) {
+        uint16_t best = (uint16_t)m;
+        for (s = 1; s < 8; s++) {
+            uint16_t img = sym_mask(s, (uint16_t)m);
+            best = (img < best) ? img : best;
+        }
+        tb.to_canon[m] = 0;
+        for (s = 0; s < 8; s++) {
+            tb.to_canon[m] |= (sym_mask(s, (uint16_t)m) == best) << s;
+        }
+        if (best == m) {
+            classes[__builtin_popcount(m)]++;
+        }
+    }
+    for (n = 0; n <= TB_CELLS; n++) { /* layers padded to whole bytes */
+        tb.first_class[n] = next;
+        next += classes[n];
+        tb.start[n + 1] = tb.start[n]
+            + ((((uint64_t)classes[n] * tb.binom[n][(n + 1) / 2]) + 3) & ~3);
+    }
+    tb.first_class[TB_CELLS + 1] = next;
+    unsigned int filled[TB_CELLS + 1] = {0};
+    for (m = 0; m < (1u << TB_CELLS); m++) { /* class masks in order */
+        if (tb.to_canon[m] & 1) {
+            n = __builtin_popcount(m);
+            tb.class_of[m] = (uint16_t)filled[n];
+            tb.canon[tb.first_class[n] + filled[n]++] = (uint16_t)m;
+        }
+    }
+    for (m = 0; m < (1u << TB_CELLS); m++) {
+        unsigned int s0 = __builtin_ctz(tb.to_canon[m]);
+        tb.class_of[m] = tb.class_of[sym_mask(s0, (uint16_t)m)];
+    }
+    const lines* l = lines_get(TB_SIDE);
+    tb.lines = l->count;
+    memcpy(tb.line_masks, l->masks, l->count * sizeof(uint64_t));
+    for (k = 0; k < 8; k++) {
+        quadrant q = (quadrant)(k >> 1);
+        pos p = make_pos((q == SW || q == SE) ? 2 : 0,
+                         (q == NE || q == SE) ? 2 : 0);
+        tb.swaps[k] = board_swaps(TB_SIDE, p, (k & 1) == CW,
+                                  tb.swap_masks[k], tb.swap_deltas[k]);
+    }
+}
+
+/* helper function that returns the colex rank of the k-subset pat */
+static unsigned int colex_rank(unsigned int pat) {
+    unsigned int r = 0, j = 0;
+    for (unsigned int i = 0; pat; i++, pat >>= 1) {
+        if (pat & 1) {
+            r += tb.binom[i][++j];
+        }
+    }
+    return r;
+}
+
+/* helper function that returns the k-subset of colex rank r */
+static unsigned int colex_unrank(unsigned int r, unsigned int k) {
+    unsigned int pat = 0;
+    for (unsigned int j = k; j > 0; j--) {
+        unsigned int i = j - 1;
+        while (tb.binom[i + 1][j] <= r) {
+            i++;
+        }
+        pat |= 1u << i;
+        r -= tb.binom[i][j];
+    }
+    return pat;
+}
+
+/* helper function that gathers the bits of x at the set bits of mask into
+the low bits, in order */
+static unsigned int gather(unsigned int x, unsigned int mask) {
+    unsigned int out = 0, bit = 0;
+    for (; mask; mask &= mask - 1, bit++) {
+        out |= ((x >> __builtin_ctz(mask)) & 1) << bit;
+    }
+    return out;
+}
+
+/* helper function that spreads the low bits of x over the set bits of
+mask, undoing gather */
+static unsigned int scatter(unsigned int x, unsigned int mask) {
+    unsigned int out = 0;
+    for (; mask; mask &= mask - 1, x >>= 1) {
+        out |= (x & 1) << __builtin_ctz(mask);
+    }
+    return out;
+}
+
+/* helper function that returns the index of the position with white and
+black masks w and b. symmetric positions share an index; when several
+symmetries fix the occupied cells the lowest white rank is used */
+static uint64_t tb_index(uint16_t w, uint16_t b) {
+    uint16_t occ = w | b;
+    unsigned int n = __builtin_popcount(occ), syms = tb.to_canon[occ];
+    unsigned int best = ~0u;
+    for (; syms; syms &= syms - 1) {
+        unsigned int s = __builtin_ctz(syms);
+        unsigned int r = colex_rank(gather(sym_mask(s, w), sym_mask(s, occ)));
+        best = (r < best) ? r : best;
+    }
+    return tb.start[n]
+         + ((uint64_t)tb.class_of[occ] * tb.binom[n][(n + 1) / 2]) + best;
+}
+
+/* helper function that returns the game state of masks w and b, with the
+codes and rules of compute_state */
+static int tb_state(uint64_t w, uint64_t b) {
+    int wl = 0, bl = 0;
+    for (unsigned int i = 0; i < tb.lines; i++) {
+        uint64_t m = tb.line_masks[i];
+        wl |= (w & m) == m;
+        bl |= (b & m) == m;
+    }
+    if (wl != bl) {
+        return wl ? 1 : 2;
+    }
+    return (wl || (w | b) == 0xffff) ? 3 : 0;
+}
+
+/* helper function that turns a finished game's state into its value for
+the player to move, white if white moves are true */
+static tb_value state_value(int state, int white) {
+    if (state == 3) {
+        return TB_DRAW;
+    }
+    return ((state == 1) == white) ? TB_WIN : TB_LOSS;
+}
+
+/* helper function that applies twist k (quadrant * 2 + direction) to x */
+static uint64_t tb_twist(uint64_t x, unsigned int k) {
+    for (unsigned int i = 0; i < tb.swaps[k]; i++) {
+        uint64_t t = ((x >> tb.swap_deltas[k][i]) ^ x) & tb.swap_masks[k][i];
+        x ^= t ^ (t << tb.swap_deltas[k][i]);
+    }
+    return x;
+}
+
+/* helper function that reads entry i of a value and a distance section */
+static tb_entry tb_read(const unsigned char* values,
+const unsigned char* dtes, uint64_t i) {
+    tb_entry e;
+    e.value = (tb_value)((values[i >> 2] >> ((i & 3) * 2)) & 3);
+    e.dte = ((dtes[i >> 1] >> ((i & 1) * 4)) & 15) + 1;
+    return e;
+}
+
+/* helper function that folds one move's result into the best so far: a
+child worth c to the opponent after d more plies is worth the opposite to
+the mover after d + 1. wins are taken fastest, losses slowest */
+static void better(tb_entry* best, tb_entry c, int* any) {
+    tb_entry e = {(tb_value)(TB_WIN - c.value), c.dte + 1};
+    int take = !*any || e.value > best->value
+        || (e.value == best->value && ((e.value == TB_LOSS)
+                                       ? e.dte > best->dte
+                                       : e.dte < best->dte));
+    if (take) {
+        *best = e;
+    }
+    *any = 1;
+}
+
+/* helper function that finds the value of the position with masks w and
+b from the solved values of the next layer */
+static tb_entry tb_solve_one(uint16_t w, uint16_t b,
+const unsigned char* values, const unsigned char* dtes) {
+    int white = __builtin_popcount(w) == __builtin_popcount(b), any = 0;
+    tb_entry best = {TB_LOSS, 0};
+    int state = tb_state(w, b);
+    if (state != 0) {
+        best.value = state_value(state, white);
+        return best;
+    }
+    uint64_t own = white ? w : b, other = white ? b : w;
+    uint16_t empty = (uint16_t)~(w | b);
+    for (; empty; empty &= empty - 1) { /* the way make_move plays */
+        uint64_t placed = own | ((uint64_t)1 << __builtin_ctz(empty));
+        int s = white ? tb_state(placed, other) : tb_state(other, placed);
+        tb_entry c = {TB_LOSS, 0};
+        if (s == 1 || s == 2) { /* placement won, every twist is skipped */
+            c.value = state_value(s, !white);
+            better(&best, c, &any);
+            continue;
+        }
+        for (unsigned int k = 0; k < 8; k++) {
+            uint64_t o = tb_twist(placed, k), x = tb_twist(other, k);
+            uint64_t cw = white ? o : x, cb = white ? x : o;
+            s = tb_state(cw, cb);
+            if (s != 0) {
+                c.value = state_value(s, !white), c.dte = 0;
+            } else {
+                c = tb_read(values, dtes, tb_index((uint16_t)cw,
+                                                   (uint16_t)cb));
+            }
+            better(&best, c, &any);
+        }
+    }
+    return best;
+}
+
+/* what the solver threads share while solving one layer */
+struct tb_job {
+    unsigned int layer;
+    atomic_ulong next;   /* first position of the next unclaimed chunk */
+    unsigned char* values;
+    unsigned char* dtes;
+    atomic_ulong counts[3]; /* losses, draws and wins found */
+};
+
+/* solver thread: claims chunks of the layer until none are left */
+static void* tb_worker(void* arg) {
+    struct tb_job* job = (struct tb_job*)arg;
+    unsigned int n = job->layer, k = (n + 1) / 2;
+    unsigned int per_class = tb.binom[n][k];
+    uint64_t size = (uint64_t)(tb.first_class[n + 1] - tb.first_class[n])
+                  * per_class;
+    unsigned long counts[3] = {0, 0, 0};
+    while (1) {
+        uint64_t from = atomic_fetch_add(&job->next, TB_CHUNK);
+        if (from >= size) {
+            break;
+        }
+        uint64_t to = (from + TB_CHUNK < size) ? from + TB_CHUNK : size;
+        unsigned int cls = (unsigned int)(from / per_class);
+        unsigned int pat = colex_unrank((unsigned int)(from % per_class), k);
+        for (uint64_t i = from; i < to; i++) {
+            uint16_t occ = tb.canon[tb.first_class[n] + cls];
+            uint16_t w = (uint16_t)scatter(pat, occ);
+            tb_entry e = tb_solve_one(w, occ & ~w, job->values, job->dtes);
+            uint64_t at = tb.start[n] + i;
+            unsigned int d = (e.dte > 0) ? e.dte - 1 : 0; /* 1 to 16 */
+            job->values[at >> 2] |= (unsigned char)(e.value << ((at & 3) * 2));
+            job->dtes[at >> 1] |= (unsigned char)(d << ((at & 1) * 4));
+            counts[e.value]++;
+            if (i + 1 - (uint64_t)cls * per_class == per_class) {
+                cls++, pat = (1u << k) - 1; /* next class, first subset */
+            } else { /* next k-subset in colex order (Gosper) */
+                unsigned int c = pat & -pat, r = pat + c;
+                pat = (((r ^ pat) >> 2) / c) | r;
+            }
+        }
+    }
+    for (unsigned int v = 0; v < 3; v++) {
+        atomic_fetch_add(&job->counts[v], counts[v]);
+    }
+    return NULL;
+}
+
+/* helper function that returns monotonic time in seconds */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+void tablebase_solve(const char* path, unsigned int threads) {
+    pthread_once(&tb.once, tb_init);
+    uint64_t total = tb.start[TB_CELLS + 1];
+    struct tb_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, tb_magic, sizeof(h.magic));
+    h.side = TB_SIDE;
+    h.layers = TB_CELLS + 1;
+    memcpy(h.start, tb.start, sizeof(h.start));
+    h.values = (sizeof(h) + 63) & ~(uint64_t)63;
+    h.dtes = (h.values + (total / 4) + 63) & ~(uint64_t)63;
+    size_t bytes = h.dtes + (total / 2);
+    unsigned char* file = (unsigned char*)calloc(bytes, 1);
+    pthread_t* ids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    if (file == NULL || ids == NULL || threads == 0) {
+        fprintf(stderr, "tablebase_solve: malloc failed.\n");
+        exit(1);
+    }
+    memcpy(file, &h, sizeof(h));
+    double start = now_seconds();
+    for (int n = TB_CELLS; n >= 0; n--) { /* each layer needs the next */
+        struct tb_job job;
+        job.layer = (unsigned int)n;
+        atomic_init(&job.next, 0);
+        job.values = file + h.values, job.dtes = file + h.dtes;
+        for (unsigned int v = 0; v < 3; v++) {
+            atomic_init(&job.counts[v], 0);
+        }
+        for (unsigned int i = 1; i < threads; i++) {
+            if (pthread_create(&ids[i], NULL, tb_worker, &job) != 0) {
+                fprintf(stderr, "tablebase_solve: could not start a "
+                "thread.\n");
+                exit(1);
+            }
+        }
+        tb_worker(&job);
+        for (unsigned int i = 1; i < threads; i++) {
+            pthread_join(ids[i], NULL);
+        }
+        printf("tablebase layer=%d positions=%lu wins=%lu draws=%lu "
+               "losses=%lu seconds=%.2f\n", n,
+               atomic_load(&job.counts[0]) + atomic_load(&job.counts[1])
+               + atomic_load(&job.counts[2]), atomic_load(&job.counts[2]),
+               atomic_load(&job.counts[1]), atomic_load(&job.counts[0]),
+               now_seconds() - start);
+    }
+    FILE* f = fopen(path, "wb");
+    if (f == NULL || fwrite(file, 1, bytes, f) != bytes || fclose(f) != 0) {
+        fprintf(stderr, "tablebase_solve: could not write %s.\n", path);
+        exit(1);
+    }
+    printf("tablebase file=%s positions=%lu bytes=%zu\n", path,
+           (unsigned long)total, bytes);
+    free(file);
+    free(ids);
+}
+
+tablebase* tablebase_open(const char* path) {
+    pthread_once(&tb.once, tb_init);
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0
+        || (size_t)st.st_size < sizeof(struct tb_header)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); /* the mapping stays valid */
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    const struct tb_header* h = (const struct tb_header*)map;
+    uint64_t total = tb.start[TB_CELLS + 1];
+    uint64_t size = (uint64_t)st.st_size;
+    /* the layers must match the index tables, and each section must lie
+    after the header, in order, inside the file (compared so no sum can
+    overflow) */
+    if (memcmp(h->magic, tb_magic, sizeof(h->magic)) != 0
+        || h->side != TB_SIDE || h->layers != TB_CELLS + 1
+        || memcmp(h->start, tb.start, sizeof(tb.start)) != 0
+        || h->values < sizeof(struct tb_header) || h->dtes < h->values
+        || h->dtes - h->values < total / 4 || h->dtes > size
+        || size - h->dtes < total / 2) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    tablebase* tbl = (tablebase*)malloc(sizeof(tablebase));
+    if (tbl == NULL) {
+        fprintf(stderr, "tablebase_open: malloc failed.\n");
+        exit(1);
+    }
+    tbl->map = (const unsigned char*)map;
+    tbl->bytes = st.st_size;
+    tbl->h = h;
+    tbl->values = tbl->map + h->values;
+    tbl->dtes = tbl->map + h->dtes;
+    return tbl;
+}
+
+void tablebase_close(tablebase* tbl) {
+    munmap((void*)tbl->map, tbl->bytes);
+    free(tbl);
+}
+
+tb_entry tablebase_probe(const tablebase* tbl, game* g) {
+    uint16_t w = 0, b = 0;
+    if (g->b->side != TB_SIDE) {
+        fprintf(stderr, "tablebase_probe: the table only covers side 4.\n");
+        exit(1);
+    }
+    if (g->b->type == MASKS) {
+        b = (uint16_t)g->b->u.masks[0], w = (uint16_t)g->b->u.masks[1];
+    } else {
+        for (unsigned int cell = 0; cell < TB_CELLS; cell++) {
+            square s = board_get(g->b, make_pos(cell / 4, cell % 4));
+            b |= (uint16_t)((s == BLACK) << cell);
+            w |= (uint16_t)((s == WHITE) << cell);
+        }
+    }
+    if (g->state != 0) { /* finished games are not worth a lookup */
+        tb_entry e = {state_value(g->state, g->next == WHITE_NEXT), 0};
+        return e;
+    }
+    return tb_read(tbl->values, tbl->dtes, tb_index(w, b));
+}
+
+move tablebase_best(const tablebase* tbl, game* g, tb_entry* e) {
+    move ms[MAX_MOVES(TB_SIDE)], best = 0;
+    unsigned int n = generate_moves(g, ms);
+    int any = 0;
+    e->value = TB_LOSS, e->dte = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        tb_entry before = *e;
+        make_move(g, ms[i]);
+        better(e, tablebase_probe(tbl, g), &any);
+        unmake_move(g, ms[i]);
+        if (i == 0 || e->value != before.value || e->dte != before.dte) {
+            best = ms[i];
+        }
+    }
+    return best;
+}
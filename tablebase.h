@@ -0,0 +1,50 @@
+#ifndef _TABLEBASE_H
+#define _TABLEBASE_H
+
+#include "logic.h"
+
+/* game value for the player to move under perfect play */
+enum tb_value {
+    TB_LOSS,
+    TB_DRAW,
+    TB_WIN
+};
+
+typedef enum tb_value tb_value;
+
+
+struct tb_entry {
+    tb_value value;
+    unsigned int dte; /* plies to the end of the game with perfect play */
+};
+
+typedef struct tb_entry tb_entry;
+
+struct tablebase;
+
+typedef struct tablebase tablebase;
+
+/* solves every 4x4 position by backward induction, one layer of marble
+count at a time from the full board down to the empty one, spreading each
+layer over threads threads, and writes the table to path. positions are
+stored once per symmetry class at 2 bits for the value and 4 for the
+distance to the end. prints one progress line per layer */
+void tablebase_solve(const char* path, unsigned int threads);
+
+/* maps the table at path into memory without reading it. returns NULL if
+the file is missing or is not a table */
+tablebase* tablebase_open(const char* path);
+
+/* unmaps a table */
+void tablebase_close(tablebase* tb);
+
+/* looks up the position of g, a 4x4 game of any type, straight from the
+mapped file */
+tb_entry tablebase_probe(const tablebase* tb, game* g);
+
+/* finds a move that keeps the best value for the player to move in g,
+winning as fast or losing as slowly as possible, and stores its result in
+e. g is searched in place and left as it was. g must not be over */
+move tablebase_best(const tablebase* tb, game* g, tb_entry* e);
+
+#endif /* _TABLEBASE_H */
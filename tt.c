@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "tt.h"
+
+/* data layout: move in bits 0-15, score in 16-47, depth in 48-55, bound in
+56-57, age in 58-63 */
+static uint64_t pack(move best, int score, int depth, bound b,
+unsigned int age) {
+    return (uint64_t)best | ((uint64_t)(uint32_t)score << 16)
+         | ((uint64_t)(depth & 0xff) << 48) | ((uint64_t)b << 56)
+         | ((uint64_t)(age & 63) << 58);
+}
+
+/* helper function that reads the depth back out of packed data */
+static int data_depth(uint64_t data) {
+    return (int)((data >> 48) & 0xff);
+}
+
+/* helper function that reads the age back out of packed data */
+static unsigned int data_age(uint64_t data) {
+    return (unsigned int)(data >> 58);
+}
+
+tt* tt_new(size_t megabytes) {
+    tt* t = (tt*)malloc(sizeof(tt));
+    if (t == NULL) {
+        fprintf(stderr, "tt_new: malloc failed.\n");
+        exit(1);
+    }
+    size_t bucket_bytes = TT_BUCKET * sizeof(tt_entry);
+    size_t want = (megabytes << 20) / bucket_bytes;
+    t->buckets = 1;
+    while (t->buckets * 2 <= want) { /* largest power of two that fits */
+        t->buckets *= 2;
+    }
+    t->entries = (tt_entry*)aligned_alloc(64, t->buckets * bucket_bytes);
+    if (t->entries == NULL) {
+        fprintf(stderr, "tt_new: malloc failed.\n");
+        exit(1);
+    }
+    tt_clear(t);
+    return t;
+}
+
+void tt_free(tt* t) {
+    free(t->entries);
+    free(t);
+}
+
+void tt_clear(tt* t) {
+    for (size_t i = 0; i < t->buckets * TT_BUCKET; i++) {
+        atomic_store_explicit(&t->entries[i].check, 0, memory_order_relaxed);
+        atomic_store_explicit(&t->entries[i].data, 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&t->age, 0, memory_order_relaxed);
+}
+
+void tt_new_search(tt* t) {
+    atomic_fetch_add_explicit(&t->age, 1, memory_order_relaxed);
+}
+
+int tt_probe(tt* t, uint64_t key, tt_hit* out) {
+    tt_entry* bucket = &t->entries[(key & (t->buckets - 1)) * TT_BUCKET];
+    for (unsigned int i = 0; i < TT_BUCKET; i++) {
+        uint64_t data = atomic_load_explicit(&bucket[i].data,
+                                             memory_order_relaxed);
+        uint64_t check = atomic_load_explicit(&bucket[i].check,
+                                              memory_order_relaxed);
+        if ((check ^ data) == key && data != 0) {
+            out->best = (move)(data & 0xffff);
+            out->score = (int)(int32_t)(uint32_t)(data >> 16);
+            out->depth = data_depth(data);
+            out->b = (bound)((data >> 56) & 3);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void tt_store(tt* t, uint64_t key, move best, int score, int depth, bound b) {
+    tt_entry* bucket = &t->entries[(key & (t->buckets - 1)) * TT_BUCKET];
+    unsigned int age = atomic_load_explicit(&t->age, memory_order_relaxed);
+    unsigned int victim = 0;
+    int victim_worth = 1 << 30;
+    for (unsigned int i = 0; i < TT_BUCKET; i++) {
+        uint64_t data = atomic_load_explicit(&bucket[i].data,
+                                             memory_order_relaxed);
+        uint64_t check = atomic_load_explicit(&bucket[i].check,
+                                              memory_order_relaxed);
+        if ((check ^ data) == key) { /* same position: refresh its slot */
+            if (best == MOVE_NONE) { /* keep the old move, if any */
+                best = (move)(data & 0xffff);
+            }
+            victim = i;
+            break;
+        }
+        /* each search of age counts as four plies of depth */
+        int worth = data_depth(data)
+                  - 4 * (int)((age - data_age(data)) & 63);
+        if (data == 0) {
+            worth = -(1 << 30); /* empty slots go first */
+        }
+        if (worth < victim_worth) {
+            victim = i;
+            victim_worth = worth;
+        }
+    }
+    uint64_t data = pack(best, score, depth, b, age);
+    atomic_store_explicit(&bucket[victim].check, key ^ data,
+                          memory_order_relaxed);
+    atomic_store_explicit(&bucket[victim].data, data, memory_order_relaxed);
+}
+
+size_t tt_bytes(tt* t) {
+    return t->buckets * TT_BUCKET * sizeof(tt_entry);
+}
@@ -0,0 +1,69 @@
+#ifndef _TT_H
+#define _TT_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "logic.h"
+
+/* entries per bucket, a bucket fills one 64-byte cache line */
+#define TT_BUCKET 4
+
+
+enum bound {
+    BOUND_NONE, BOUND_UPPER, BOUND_LOWER, BOUND_EXACT
+};
+
+typedef enum bound bound;
+
+/* one slot, stored as (key ^ data, data) so that a slot torn by two threads
+writing at once fails the key check instead of returning mixed data */
+struct tt_entry {
+    _Atomic uint64_t check;
+    _Atomic uint64_t data;
+};
+
+typedef struct tt_entry tt_entry;
+
+struct tt_hit {
+    move best;       /* MOVE_NONE if none was stored */
+    int score;
+    int depth;
+    bound b;
+};
+
+typedef struct tt_hit tt_hit;
+
+struct tt {
+    tt_entry* entries;
+    size_t buckets;              /* a power of two */
+    _Atomic unsigned int age;    /* bumped by every new search, 6 bits */
+};
+
+typedef struct tt tt;
+
+/* creates an empty transposition table of at most megabytes MB */
+tt* tt_new(size_t megabytes);
+
+/* frees a transposition table */
+void tt_free(tt* t);
+
+/* empties every slot */
+void tt_clear(tt* t);
+
+/* starts a new search: older entries become preferred for replacement */
+void tt_new_search(tt* t);
+
+/* looks key up, filling out and returning 1 if it is stored */
+int tt_probe(tt* t, uint64_t key, tt_hit* out);
+
+/* stores a search result for key, with best MOVE_NONE if it found no move.
+a slot already holding key is reused and keeps its move in that case,
+otherwise the shallowest slot of the bucket, counting older searches as
+shallower, is replaced */
+void tt_store(tt* t, uint64_t key, move best, int score, int depth, bound b);
+
+/* returns the bytes of memory the table's slots take */
+size_t tt_bytes(tt* t);
+
+#endif /* _TT_H */